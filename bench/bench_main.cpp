@@ -0,0 +1,598 @@
+// Benchmarks for the simulation engine and its serializers.
+//
+// Usage: ecosim_bench [--json] [repetitions]
+//
+// Every measurement is repeated (20 times by default) and reported with the
+// median, 99th percentile, mean and variance of its wall times, plus rates
+// derived from the median. With --json each measurement is printed as one JSON
+// object per line instead of a table row, for scripts comparing runs.
+//
+// It also checks that steady-state ticks make no heap allocations, counting
+// them with a replaced operator new, that grids do not depend on the number
+// of threads, and that reads of a background run do not wait for its ticks,
+// and exits with an error when one of those fails.
+
+#include "aging.hpp"
+#include "json.hpp"
+#include "rng.hpp"
+#include "serialize.hpp"
+#include "simulation.hpp"
+#include "world.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <thread>
+
+// Reference path: the nlohmann::json tree the endpoints used to build
+NLOHMANN_JSON_SERIALIZE_ENUM(entity_type_t, {
+                                                {empty, " "},
+                                                {plant, "P"},
+                                                {herbivore, "H"},
+                                                {carnivore, "C"},
+                                            })
+
+namespace nlohmann
+{
+    void to_json(nlohmann::json &j, const entity_t &e)
+    {
+        j = nlohmann::json{{"type", e.type}, {"energy", e.energy}, {"age", e.age}};
+    }
+}
+
+static std::string grid_to_json_tree(const grid_t &grid)
+{
+    nlohmann::json j = nlohmann::json::array();
+    for (uint32_t i = 0; i < grid.height; ++i)
+    {
+        nlohmann::json row = nlohmann::json::array();
+        for (uint32_t c = 0; c < grid.width; ++c)
+            row.push_back(grid.get(grid.index(i, c)));
+        j.push_back(std::move(row));
+    }
+    return j.dump();
+}
+
+// Heap allocations made by any thread since the start
+static std::atomic<uint64_t> allocations{0};
+
+// Every replaceable allocation function counts and goes to malloc, or to
+// aligned_alloc for over-aligned types, and every deallocation function
+// hands the block to free, which takes both.
+static void *counted_alloc(std::size_t size, std::size_t alignment = 0)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    size = size ? size : 1;
+    if (alignment)
+        return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    return std::malloc(size);
+}
+
+static void *counted_new(std::size_t size, std::size_t alignment = 0)
+{
+    if (void *p = counted_alloc(size, alignment))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size) { return counted_new(size); }
+void *operator new[](std::size_t size) { return counted_new(size); }
+void *operator new(std::size_t size, std::align_val_t al) { return counted_new(size, (std::size_t)al); }
+void *operator new[](std::size_t size, std::align_val_t al) { return counted_new(size, (std::size_t)al); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept { return counted_alloc(size); }
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept { return counted_alloc(size); }
+void *operator new(std::size_t size, std::align_val_t al, const std::nothrow_t &) noexcept
+{
+    return counted_alloc(size, (std::size_t)al);
+}
+void *operator new[](std::size_t size, std::align_val_t al, const std::nothrow_t &) noexcept
+{
+    return counted_alloc(size, (std::size_t)al);
+}
+
+// GCC cannot tell that the blocks freed here came from the malloc above once
+// these are inlined into new expressions, and warns of a mismatch
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept { std::free(p); }
+#pragma GCC diagnostic pop
+
+// Wall times of the repetitions of one measurement, in seconds
+struct samples_t
+{
+    std::vector<double> times;
+
+    double mean() const
+    {
+        double sum = 0;
+        for (double t : times)
+            sum += t;
+        return sum / times.size();
+    }
+
+    // Unbiased sample variance
+    double variance() const
+    {
+        if (times.size() < 2)
+            return 0;
+        const double m = mean();
+        double sum = 0;
+        for (double t : times)
+            sum += (t - m) * (t - m);
+        return sum / (times.size() - 1);
+    }
+
+    // Nearest-rank percentile, p in (0, 1]
+    double percentile(double p) const
+    {
+        std::vector<double> sorted = times;
+        std::sort(sorted.begin(), sorted.end());
+        const size_t rank = (size_t)std::ceil(p * sorted.size());
+        return sorted[std::max<size_t>(rank, 1) - 1];
+    }
+
+    double median() const { return percentile(0.5); }
+};
+
+static double time_once(const std::function<void()> &fn)
+{
+    const auto start = std::chrono::steady_clock::now();
+    fn();
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+static samples_t measure(int repetitions, const std::function<void()> &fn)
+{
+    samples_t samples;
+    for (int r = 0; r < repetitions; ++r)
+        samples.times.push_back(time_once(fn));
+    return samples;
+}
+
+static bool json_lines = false;
+
+static void print_header()
+{
+    if (!json_lines)
+        std::printf("%-12s %-44s %10s %10s %10s %12s  %s\n", "benchmark", "case", "median ms", "p99 ms", "mean ms",
+                    "var ms^2", "rates");
+}
+
+// Prints one measurement. The case is named by params; rates holds extra
+// figures such as throughputs, derived from the median by the caller.
+static void report(const char *bench, const nlohmann::json &params, const samples_t &samples,
+                   const nlohmann::json &rates = nlohmann::json::object())
+{
+    if (json_lines)
+    {
+        nlohmann::json line = {{"benchmark", bench}};
+        line.update(params);
+        line.update({{"repetitions", samples.times.size()},
+                     {"median_ms", samples.median() * 1e3},
+                     {"p99_ms", samples.percentile(0.99) * 1e3},
+                     {"mean_ms", samples.mean() * 1e3},
+                     {"variance_ms2", samples.variance() * 1e6}});
+        line.update(rates);
+        std::printf("%s\n", line.dump().c_str());
+        return;
+    }
+
+    std::string name;
+    for (auto it = params.begin(); it != params.end(); ++it)
+        name += (name.empty() ? "" : " ") + it.key() + "=" + (it->is_string() ? it->get<std::string>() : it->dump());
+    std::string extra;
+    for (auto it = rates.begin(); it != rates.end(); ++it)
+    {
+        char value[64];
+        std::snprintf(value, sizeof(value), "%s=%.3g", it.key().c_str(), it->get<double>());
+        extra += (extra.empty() ? "" : " ") + std::string(value);
+    }
+    std::printf("%-12s %-44s %10.3f %10.3f %10.3f %12.4g  %s\n", bench, name.c_str(), samples.median() * 1e3,
+                samples.percentile(0.99) * 1e3, samples.mean() * 1e3, samples.variance() * 1e6, extra.c_str());
+}
+
+static void fail(const char *message)
+{
+    std::fprintf(stderr, "%s\n", message);
+    std::exit(1);
+}
+
+// A classic run with the given fraction of occupied cells, split evenly between species
+static simulation_config_t classic_run(uint32_t size, double density)
+{
+    simulation_config_t config;
+    config.width = config.height = size;
+    config.seed = 1;
+    const uint32_t third = (uint32_t)(size * (double)size * density / 3);
+    config.counts = {third, third, third};
+    return config;
+}
+
+static uint64_t entities(const world_t &world)
+{
+    return world.grid().size() - world.population()[empty];
+}
+
+// Times single ticks after a short warm-up, so the samples come from a run
+// that already left its initial arrangement
+static samples_t measure_ticks(int repetitions, world_t &world, double &mean_entities)
+{
+    for (int t = 0; t < 3; ++t)
+        world.step();
+    samples_t samples;
+    uint64_t total = 0;
+    for (int r = 0; r < repetitions; ++r)
+    {
+        total += entities(world);
+        samples.times.push_back(time_once([&]
+                                          { world.step(); }));
+    }
+    mean_entities = (double)total / repetitions;
+    return samples;
+}
+
+// Thread counts the tick benchmark sweeps: powers of two up to the core
+// count, and the core count itself
+static std::vector<unsigned> thread_counts()
+{
+    const unsigned cores = std::max(std::thread::hardware_concurrency(), 1u);
+    std::vector<unsigned> counts;
+    for (unsigned threads = 1; threads < cores; threads *= 2)
+        counts.push_back(threads);
+    counts.push_back(cores);
+    return counts;
+}
+
+static void bench_ticks(int repetitions)
+{
+    for (uint32_t size : {256u, 1024u, 2048u})
+    {
+        for (double density : {0.1, 0.5, 0.9})
+        {
+            double single_thread = 0;
+            for (unsigned threads : thread_counts())
+            {
+                simulation_config_t config = classic_run(size, density);
+                config.threads = threads;
+                world_t world;
+                start_world(world, config);
+                double mean_entities;
+                const samples_t samples = measure_ticks(repetitions, world, mean_entities);
+                if (threads == 1)
+                    single_thread = samples.median();
+                report("tick", {{"size", size}, {"density", density}, {"threads", world.threads()}}, samples,
+                       {{"cells_per_s", size * (double)size / samples.median()},
+                        {"entities_per_s", mean_entities / samples.median()},
+                        {"speedup", single_thread / samples.median()}});
+            }
+        }
+    }
+}
+
+// Setting up a run as /start-simulation does, with a fresh world each time
+static void bench_placement(int repetitions)
+{
+    for (uint32_t size : {256u, 1024u, 4096u})
+    {
+        for (double density : {0.1, 0.5, 0.9})
+        {
+            const simulation_config_t config = classic_run(size, density);
+            uint64_t placed = 0;
+            for (uint32_t count : config.counts)
+                placed += count;
+            const samples_t samples = measure(repetitions, [&]
+                                              {
+                world_t world;
+                start_world(world, config); });
+            report("placement", {{"size", size}, {"density", density}}, samples,
+                   {{"cells_per_s", size * (double)size / samples.median()},
+                    {"entities_per_s", placed / samples.median()}});
+        }
+    }
+}
+
+static void bench_serialization(int repetitions)
+{
+    for (uint32_t size : {15u, 256u, 1024u})
+    {
+        world_t world;
+        start_world(world, classic_run(size, 0.3));
+        for (int t = 0; t < 10; ++t)
+            world.step();
+        const grid_t &grid = world.grid();
+        const uint64_t tick = world.tick();
+        const std::string symbols = world.species().symbols();
+        std::vector<uint32_t> changes;
+        world.changed_since(tick - 1, changes);
+        if (grid_to_json_tree(grid) != grid_to_json(grid, symbols))
+            fail("json writer disagrees with the nlohmann tree");
+
+        std::string out;
+        const std::pair<const char *, std::function<void()>> formats[] = {
+            {"json_tree", [&]
+             { out = grid_to_json_tree(grid); }},
+            {"json", [&]
+             { write_grid_json(grid, symbols, out); }},
+            {"binary", [&]
+             { write_grid_binary(grid, tick, out); }},
+            {"delta_json", [&]
+             { write_delta_json(grid, symbols, tick - 1, tick, changes, out); }},
+            {"delta_binary", [&]
+             { write_delta_binary(grid, tick - 1, tick, changes, out); }},
+        };
+        for (const auto &format : formats)
+        {
+            const samples_t samples = measure(repetitions, format.second);
+            report("serialize", {{"format", format.first}, {"size", size}}, samples,
+                   {{"bytes", (double)out.size()}, {"bytes_per_s", out.size() / samples.median()}});
+        }
+    }
+}
+
+// Ages every cell of the grid with the given kernel, returning the dead cells
+static std::vector<uint64_t> age_grid(aging_kernel_t kernel, const aging_rules_t &rules, grid_t &grid)
+{
+    std::vector<uint64_t> dead(grid.size() / AGING_BLOCK);
+    for (size_t block = 0; block < dead.size(); ++block)
+    {
+        const size_t first = block * AGING_BLOCK;
+        dead[block] = kernel(rules, &grid.type[first], &grid.energy[first], &grid.age[first]);
+    }
+    return dead;
+}
+
+// Aging kernels the running CPU can execute. Off x86 the SIMD entry points
+// only forward to the scalar kernel, so they are left out there too.
+static std::vector<std::pair<const char *, aging_kernel_t>> supported_aging_kernels()
+{
+    std::vector<std::pair<const char *, aging_kernel_t>> kernels = {{"scalar", age_block_scalar}};
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        kernels.push_back({"sse2", age_block_sse2});
+    if (__builtin_cpu_supports("avx2"))
+        kernels.push_back({"avx2", age_block_avx2});
+#endif
+    return kernels;
+}
+
+static void bench_aging(int repetitions)
+{
+    const aging_rules_t rules = classic_species().aging_rules();
+    const std::vector<std::pair<const char *, aging_kernel_t>> kernels = supported_aging_kernels();
+
+    const uint32_t size = 1024;
+    for (double density : {0.1, 0.5, 0.9})
+    {
+        world_t world;
+        start_world(world, classic_run(size, density));
+
+        // Spread ages and energies so that some of every species die
+        grid_t base = world.grid();
+        const counter_rng_t rng{2};
+        for (size_t idx = 0; idx < base.size(); ++idx)
+        {
+            if (base.type[idx] == empty)
+                continue;
+            const std::array<uint32_t, 4> words = rng.draw(0, idx, 0);
+            base.age[idx] = (int16_t)(words[0] % (CARNIVORE_MAXIMUM_AGE + 2));
+            base.energy[idx] = (int16_t)(words[1] % 110) - 10;
+        }
+
+        std::vector<uint64_t> expected_dead;
+        grid_t expected;
+        for (size_t k = 0; k < kernels.size(); ++k)
+        {
+            grid_t grid = base;
+            const std::vector<uint64_t> dead = age_grid(kernels[k].second, rules, grid);
+            if (k == 0)
+            {
+                expected_dead = dead;
+                expected = grid;
+            }
+            else if (dead != expected_dead || grid.age != expected.age)
+            {
+                fail("aging kernels disagree");
+            }
+
+            // Ages keep growing across repetitions, which only saturates them
+            const samples_t samples = measure(repetitions, [&]
+                                              { age_grid(kernels[k].second, rules, grid); });
+            report("aging", {{"kernel", kernels[k].first}, {"size", size}, {"density", density}}, samples,
+                   {{"cells_per_s", size * (double)size / samples.median()}});
+        }
+    }
+    if (!json_lines)
+        std::printf("%-12s dispatched kernel: %s\n", "aging", aging_kernel_name());
+}
+
+// Ticks of the same run under each edge and neighborhood setting
+static void bench_topologies(int repetitions)
+{
+    const uint32_t size = 256;
+    for (bool toroidal : {false, true})
+    {
+        for (unsigned neighborhood : {4u, 8u})
+        {
+            simulation_config_t config = classic_run(size, 0.5);
+            config.topology.toroidal = toroidal;
+            config.topology.neighborhood = neighborhood;
+            world_t world;
+            start_world(world, config);
+            double mean_entities;
+            const samples_t samples = measure_ticks(repetitions, world, mean_entities);
+            report("topology", {{"edges", toroidal ? "toroidal" : "bounded"}, {"neighborhood", neighborhood}},
+                   samples, {{"cells_per_s", size * (double)size / samples.median()}});
+        }
+    }
+}
+
+// Ticks run before counting allocations. The step's buffers grow to their
+// high-water marks early on, the runs below stop allocating before tick 200.
+const int ALLOCATION_WARMUP_TICKS = 1000;
+const int ALLOCATION_CHECK_TICKS = 200;
+
+// Steady-state ticks must not touch the heap
+static void check_allocations()
+{
+    for (bool toroidal : {false, true})
+    {
+        simulation_config_t config = classic_run(256, 0.5);
+        config.topology.toroidal = toroidal;
+        config.topology.neighborhood = toroidal ? 8 : 4;
+        world_t world;
+        start_world(world, config);
+        for (int t = 0; t < ALLOCATION_WARMUP_TICKS; ++t)
+            world.step();
+
+        const uint64_t before = allocations.load();
+        for (int t = 0; t < ALLOCATION_CHECK_TICKS; ++t)
+            world.step();
+        const uint64_t made = allocations.load() - before;
+
+        const char *edges = toroidal ? "toroidal" : "bounded";
+        if (json_lines)
+            std::printf("%s\n", nlohmann::json{{"benchmark", "allocations"},
+                                               {"edges", edges},
+                                               {"warmup_ticks", ALLOCATION_WARMUP_TICKS},
+                                               {"ticks", ALLOCATION_CHECK_TICKS},
+                                               {"allocations", made}}
+                                    .dump()
+                                    .c_str());
+        else
+            std::printf("%-12s edges=%-38s %llu allocations in %d ticks after %d\n", "allocations", edges,
+                        (unsigned long long)made, ALLOCATION_CHECK_TICKS, ALLOCATION_WARMUP_TICKS);
+        if (made != 0)
+            fail("steady-state ticks allocated memory");
+    }
+}
+
+// Thread counts whose runs must match the single-threaded one, more than
+// this machine may have cores
+const unsigned DETERMINISM_THREADS[] = {2, 3, 4, 8, 16};
+const int DETERMINISM_TICKS = 100;
+
+// A run must end on the same grid whatever the number of threads stepping
+// it. The height is not a multiple of TILE_ROWS, so the last tile is short.
+static void check_thread_determinism()
+{
+    for (bool toroidal : {false, true})
+    {
+        simulation_config_t config = classic_run(200, 0.5);
+        config.height = 150;
+        config.topology.toroidal = toroidal;
+        config.topology.neighborhood = toroidal ? 8 : 4;
+
+        // Steps the run with the given number of threads
+        const auto run = [&](unsigned threads, world_t &world)
+        {
+            start_world(world, config);
+            world.set_threads(threads, true);
+            for (int t = 0; t < DETERMINISM_TICKS; ++t)
+                world.step();
+        };
+        world_t single;
+        run(1, single);
+        const grid_t &expected = single.grid();
+
+        for (unsigned threads : DETERMINISM_THREADS)
+        {
+            world_t world;
+            run(threads, world);
+            const grid_t &grid = world.grid();
+            const bool same = grid.type == expected.type && grid.energy == expected.energy && grid.age == expected.age;
+            const char *edges = toroidal ? "toroidal" : "bounded";
+            if (json_lines)
+                std::printf("%s\n", nlohmann::json{{"benchmark", "determinism"},
+                                                   {"edges", edges},
+                                                   {"threads", world.threads()},
+                                                   {"ticks", DETERMINISM_TICKS},
+                                                   {"identical", same}}
+                                        .dump()
+                                        .c_str());
+            else
+                std::printf("%-12s %-44s %s to 1 thread after %d ticks\n", "determinism",
+                            ("edges=" + std::string(edges) + " threads=" + std::to_string(world.threads())).c_str(),
+                            same ? "identical" : "different", DETERMINISM_TICKS);
+            if (!same)
+                fail("grids differ between thread counts");
+        }
+    }
+}
+
+// Reads of a background run sampled while it steps
+const int BACKGROUND_READS = 50;
+
+// Reading a background run must not wait for the tick in progress. Its ticks
+// take tens of milliseconds at this size, a read that waited for the world
+// lock would take a sizable part of one.
+static void check_background_reads()
+{
+    simulation_config_t config = classic_run(1024, 0.5);
+    config.background = true;
+    simulation_t simulation;
+    simulation.start(config);
+    while (simulation.snapshot()->tick < 2)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    const auto start = std::chrono::steady_clock::now();
+    const uint64_t first_tick = simulation.snapshot()->tick;
+    samples_t reads;
+    for (int r = 0; r < BACKGROUND_READS; ++r)
+    {
+        reads.times.push_back(time_once([&]
+                                        { simulation.advance(); }));
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    const uint64_t ticks = simulation.snapshot()->tick - first_tick;
+    simulation.stop();
+    if (ticks == 0)
+        fail("the background run did not step");
+
+    const double tick_time = elapsed.count() / ticks;
+    report("background", {{"size", config.width}, {"case", "read"}}, reads, {{"tick_ms", tick_time * 1e3}});
+    if (reads.percentile(1) >= tick_time / 2)
+        fail("reads of a background run waited for its ticks");
+}
+
+int main(int argc, char **argv)
+{
+    int repetitions = 20;
+    for (int k = 1; k < argc; ++k)
+    {
+        if (std::strcmp(argv[k], "--json") == 0)
+            json_lines = true;
+        else
+            repetitions = std::max(std::atoi(argv[k]), 1);
+    }
+
+    print_header();
+    check_allocations();
+    check_thread_determinism();
+    check_background_reads();
+    bench_ticks(repetitions);
+    bench_placement(repetitions);
+    bench_serialization(repetitions);
+    bench_aging(repetitions);
+    bench_topologies(repetitions);
+    return 0;
+}
@@ -0,0 +1,467 @@
+// HTTP load generator for a running ecosim server.
+//
+// Usage: ecosim_load [options]
+//
+//   --host <address>      server address (127.0.0.1)
+//   --port <port>         server port (8080)
+//   --connections <n>     concurrent clients, one keep-alive connection each (8)
+//   --duration <seconds>  length of the run (10)
+//   --size <cells>        width and height of each client's simulation (256)
+//   --density <fraction>  initial share of occupied cells (0.3)
+//   --steps <n>           ticks per /next-iteration (1)
+//   --restart <n>         requests between /start-simulation restarts, 0 never (0)
+//   --binary              ask for binary frames instead of JSON
+//   --json                print the report as one JSON object
+//
+// Every client starts its own session, then advances it in a loop, restarting
+// it every --restart requests. The report gives requests/s, bytes/s and a
+// latency histogram per endpoint.
+
+#include "json.hpp"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using steady = std::chrono::steady_clock;
+
+// Log-linear latency histogram in microseconds: exact below 16 us, then 8
+// buckets per power of two, which keeps percentiles within 12.5%
+struct histogram_t
+{
+    static const unsigned SUB_BUCKETS = 8;
+    static const unsigned LINEAR = 16;
+    std::vector<uint64_t> counts = std::vector<uint64_t>(LINEAR + 64 * SUB_BUCKETS, 0);
+    uint64_t total = 0;
+    uint64_t maximum = 0;
+    double sum = 0;
+
+    static unsigned bucket(uint64_t us)
+    {
+        if (us < LINEAR)
+            return (unsigned)us;
+        const unsigned exponent = 63 - __builtin_clzll(us);
+        const unsigned sub = (unsigned)(us >> (exponent - 3)) & (SUB_BUCKETS - 1);
+        return LINEAR + (exponent - 4) * SUB_BUCKETS + sub;
+    }
+
+    // Largest value that falls in the bucket
+    static uint64_t upper_bound(unsigned bucket)
+    {
+        if (bucket < LINEAR)
+            return bucket;
+        const unsigned exponent = (bucket - LINEAR) / SUB_BUCKETS + 4;
+        const uint64_t sub = (bucket - LINEAR) % SUB_BUCKETS;
+        return ((SUB_BUCKETS + sub + 1) << (exponent - 3)) - 1;
+    }
+
+    void record(uint64_t us)
+    {
+        ++counts[bucket(us)];
+        ++total;
+        maximum = std::max(maximum, us);
+        sum += us;
+    }
+
+    void merge(const histogram_t &other)
+    {
+        for (size_t k = 0; k < counts.size(); ++k)
+            counts[k] += other.counts[k];
+        total += other.total;
+        maximum = std::max(maximum, other.maximum);
+        sum += other.sum;
+    }
+
+    uint64_t percentile(double p) const
+    {
+        const uint64_t rank = std::max<uint64_t>((uint64_t)std::ceil(p * total), 1);
+        uint64_t seen = 0;
+        for (unsigned k = 0; k < counts.size(); ++k)
+        {
+            seen += counts[k];
+            if (seen >= rank)
+                return std::min(upper_bound(k), maximum);
+        }
+        return maximum;
+    }
+};
+
+// Requests of one endpoint
+struct endpoint_stats_t
+{
+    histogram_t latency;
+    uint64_t errors = 0; // Non-2xx answers and requests that got no answer
+    uint64_t bytes_sent = 0;
+    uint64_t bytes_received = 0;
+
+    void merge(const endpoint_stats_t &other)
+    {
+        latency.merge(other.latency);
+        errors += other.errors;
+        bytes_sent += other.bytes_sent;
+        bytes_received += other.bytes_received;
+    }
+};
+
+struct options_t
+{
+    std::string host = "127.0.0.1";
+    std::string port = "8080";
+    unsigned connections = 8;
+    double duration = 10;
+    uint32_t size = 256;
+    double density = 0.3;
+    uint32_t steps = 1;
+    uint32_t restart = 0;
+    bool binary = false;
+    bool json = false;
+};
+
+static int connect_to(const options_t &options)
+{
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *addresses = nullptr;
+    if (getaddrinfo(options.host.c_str(), options.port.c_str(), &hints, &addresses) != 0)
+        return -1;
+
+    int fd = -1;
+    for (addrinfo *a = addresses; a != nullptr && fd < 0; a = a->ai_next)
+    {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (fd >= 0)
+    {
+        const int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+// Value of a response header, matched without regard to case
+static std::string header_value(const std::string &head, const char *name)
+{
+    const size_t length = std::strlen(name);
+    for (size_t line = head.find("\r\n"); line != std::string::npos; line = head.find("\r\n", line + 2))
+    {
+        const size_t start = line + 2;
+        if (head.size() > start + length && head[start + length] == ':' &&
+            strncasecmp(head.c_str() + start, name, length) == 0)
+        {
+            size_t begin = start + length + 1;
+            while (begin < head.size() && head[begin] == ' ')
+                ++begin;
+            return head.substr(begin, head.find("\r\n", begin) - begin);
+        }
+    }
+    return "";
+}
+
+// One keep-alive HTTP/1.1 connection, reconnected after any failure
+class client_t
+{
+public:
+    explicit client_t(const options_t &options) : options_(options) {}
+    ~client_t() { disconnect(); }
+
+    // Sends a request and reads the whole answer, returning its status code,
+    // or 0 when the connection failed
+    int request(const std::string &request, std::string &head, uint64_t &received)
+    {
+        received = 0;
+        if (fd_ < 0 && (fd_ = connect_to(options_)) < 0)
+            return 0;
+        if (!send_all(request))
+            return fail();
+
+        // Headers, then a body of Content-Length bytes
+        buffer_.clear();
+        size_t end;
+        while ((end = buffer_.find("\r\n\r\n")) == std::string::npos)
+            if (!receive())
+                return fail();
+        head = buffer_.substr(0, end);
+        const std::string length = header_value(head, "Content-Length");
+        if (length.empty())
+            return fail();
+        const size_t total = end + 4 + std::strtoull(length.c_str(), nullptr, 10);
+        while (buffer_.size() < total)
+            if (!receive())
+                return fail();
+        received = buffer_.size();
+
+        if (strcasecmp(header_value(head, "Connection").c_str(), "close") == 0)
+            disconnect();
+        return std::atoi(head.c_str() + head.find(' ') + 1);
+    }
+
+private:
+    bool send_all(const std::string &data)
+    {
+        for (size_t sent = 0; sent < data.size();)
+        {
+            const ssize_t n = send(fd_, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+                return false;
+            sent += (size_t)n;
+        }
+        return true;
+    }
+
+    bool receive()
+    {
+        char chunk[64 * 1024];
+        const ssize_t n = recv(fd_, chunk, sizeof(chunk), 0);
+        if (n <= 0)
+            return false;
+        buffer_.append(chunk, (size_t)n);
+        return true;
+    }
+
+    int fail()
+    {
+        disconnect();
+        return 0;
+    }
+
+    void disconnect()
+    {
+        if (fd_ >= 0)
+            close(fd_);
+        fd_ = -1;
+    }
+
+    const options_t &options_;
+    int fd_ = -1;
+    std::string buffer_;
+};
+
+struct client_stats_t
+{
+    endpoint_stats_t start;
+    endpoint_stats_t next;
+};
+
+static std::string start_request(const options_t &options, const std::string &session)
+{
+    const uint32_t third = (uint32_t)(options.size * (double)options.size * options.density / 3);
+    nlohmann::json body = {{"width", options.size}, {"height", options.size}, {"plants", third},
+                           {"herbivores", third}, {"carnivores", third}, {"threads", 1}};
+    if (!session.empty())
+        body["session"] = session;
+    const std::string text = body.dump();
+    return "POST /start-simulation HTTP/1.1\r\nHost: " + options.host + "\r\nContent-Type: application/json\r\n" +
+           "Content-Length: " + std::to_string(text.size()) + "\r\n\r\n" + text;
+}
+
+static std::string next_request(const options_t &options, const std::string &session)
+{
+    return "GET /next-iteration?session=" + session + "&steps=" + std::to_string(options.steps) +
+           " HTTP/1.1\r\nHost: " + options.host + "\r\n" +
+           (options.binary ? "Accept: application/octet-stream\r\n" : "") + "\r\n";
+}
+
+// Times one request into the endpoint's statistics, returning its status code
+static int timed(client_t &client, const std::string &request, endpoint_stats_t &stats, std::string &head)
+{
+    uint64_t received;
+    const auto start = steady::now();
+    const int status = client.request(request, head, received);
+    if (status < 200 || status >= 300)
+        ++stats.errors;
+    if (status == 0)
+        return status;
+
+    // Only answered requests count towards latency and traffic
+    stats.latency.record((uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(steady::now() - start).count());
+    stats.bytes_sent += request.size();
+    stats.bytes_received += received;
+    return status;
+}
+
+static void run_client(const options_t &options, steady::time_point deadline, client_stats_t &stats)
+{
+    client_t client(options);
+    std::string session;
+    std::string head;
+    uint32_t since_start = 0;
+    while (steady::now() < deadline)
+    {
+        if (session.empty() || (options.restart != 0 && since_start >= options.restart))
+        {
+            const int status = timed(client, start_request(options, session), stats.start, head);
+            if (status < 200 || status >= 300)
+            {
+                // A restart of a session the server dropped starts a new one
+                session.clear();
+                if (status == 0)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            session = header_value(head, "X-Ecosim-Session");
+            since_start = 0;
+        }
+
+        if (timed(client, next_request(options, session), stats.next, head) == 404)
+            session.clear();
+        ++since_start;
+    }
+}
+
+static nlohmann::json summary(const endpoint_stats_t &stats, double seconds)
+{
+    const histogram_t &h = stats.latency;
+    return {{"requests", h.total},
+            {"errors", stats.errors},
+            {"requests_per_s", h.total / seconds},
+            {"bytes_sent_per_s", stats.bytes_sent / seconds},
+            {"bytes_received_per_s", stats.bytes_received / seconds},
+            {"latency_us",
+             {{"mean", h.total ? h.sum / h.total : 0},
+              {"p50", h.percentile(0.5)},
+              {"p90", h.percentile(0.9)},
+              {"p99", h.percentile(0.99)},
+              {"p999", h.percentile(0.999)},
+              {"max", h.maximum}}}};
+}
+
+static void print_endpoint(const char *name, const endpoint_stats_t &stats, double seconds)
+{
+    const histogram_t &h = stats.latency;
+    if (h.total == 0 && stats.errors == 0)
+        return;
+    std::printf("%s: %llu requests, %llu errors, %.1f req/s, %.2f MB/s received, %.2f MB/s sent\n", name,
+                (unsigned long long)h.total, (unsigned long long)stats.errors, h.total / seconds,
+                stats.bytes_received / seconds / 1e6, stats.bytes_sent / seconds / 1e6);
+    if (h.total == 0)
+        return;
+    std::printf("  latency us: mean %.0f  p50 %llu  p90 %llu  p99 %llu  p99.9 %llu  max %llu\n", h.sum / h.total,
+                (unsigned long long)h.percentile(0.5), (unsigned long long)h.percentile(0.9),
+                (unsigned long long)h.percentile(0.99), (unsigned long long)h.percentile(0.999),
+                (unsigned long long)h.maximum);
+
+    // Non-empty buckets as a bar chart
+    uint64_t peak = 0;
+    for (uint64_t count : h.counts)
+        peak = std::max(peak, count);
+    for (unsigned k = 0; k < h.counts.size(); ++k)
+    {
+        if (h.counts[k] == 0)
+            continue;
+        const int width = (int)std::ceil(40.0 * h.counts[k] / peak);
+        std::printf("  <= %8llu us %8llu %.*s\n", (unsigned long long)histogram_t::upper_bound(k),
+                    (unsigned long long)h.counts[k], width, "########################################");
+    }
+}
+
+static bool parse_options(int argc, char **argv, options_t &options)
+{
+    for (int k = 1; k < argc; ++k)
+    {
+        const std::string flag = argv[k];
+        if (flag == "--binary")
+        {
+            options.binary = true;
+            continue;
+        }
+        if (flag == "--json")
+        {
+            options.json = true;
+            continue;
+        }
+        if (k + 1 >= argc)
+            return false;
+        const char *value = argv[++k];
+        if (flag == "--host")
+            options.host = value;
+        else if (flag == "--port")
+            options.port = value;
+        else if (flag == "--connections")
+            options.connections = (unsigned)std::atoi(value);
+        else if (flag == "--duration")
+            options.duration = std::atof(value);
+        else if (flag == "--size")
+            options.size = (uint32_t)std::atoi(value);
+        else if (flag == "--density")
+            options.density = std::atof(value);
+        else if (flag == "--steps")
+            options.steps = (uint32_t)std::atoi(value);
+        else if (flag == "--restart")
+            options.restart = (uint32_t)std::atoi(value);
+        else
+            return false;
+    }
+    return options.connections > 0 && options.duration > 0 && options.size > 0 && options.steps > 0 &&
+           options.density >= 0 && options.density <= 1;
+}
+
+int main(int argc, char **argv)
+{
+    options_t options;
+    if (!parse_options(argc, argv, options))
+    {
+        std::fprintf(stderr,
+                     "usage: %s [--host H] [--port P] [--connections N] [--duration S] [--size W] "
+                     "[--density D] [--steps K] [--restart R] [--binary] [--json]\n",
+                     argv[0]);
+        return 2;
+    }
+
+    std::vector<client_stats_t> stats(options.connections);
+    std::vector<std::thread> clients;
+    const auto start = steady::now();
+    const auto deadline = start + std::chrono::duration_cast<steady::duration>(
+                                      std::chrono::duration<double>(options.duration));
+    for (unsigned k = 0; k < options.connections; ++k)
+        clients.emplace_back(run_client, std::cref(options), deadline, std::ref(stats[k]));
+    for (std::thread &client : clients)
+        client.join();
+    const double seconds = std::chrono::duration<double>(steady::now() - start).count();
+
+    client_stats_t total;
+    for (const client_stats_t &s : stats)
+    {
+        total.start.merge(s.start);
+        total.next.merge(s.next);
+    }
+    endpoint_stats_t all = total.start;
+    all.merge(total.next);
+
+    if (options.json)
+    {
+        const nlohmann::json report = {
+            {"connections", options.connections}, {"seconds", seconds}, {"size", options.size},
+            {"steps", options.steps}, {"binary", options.binary}, {"start_simulation", summary(total.start, seconds)},
+            {"next_iteration", summary(total.next, seconds)}, {"total", summary(all, seconds)}};
+        std::printf("%s\n", report.dump().c_str());
+    }
+    else
+    {
+        std::printf("%u connections for %.1f s, %ux%u grids, %u steps per request, %s frames\n", options.connections,
+                    seconds, options.size, options.size, options.steps, options.binary ? "binary" : "JSON");
+        print_endpoint("/start-simulation", total.start, seconds);
+        print_endpoint("/next-iteration", total.next, seconds);
+        std::printf("total: %.1f req/s, %.2f MB/s received\n", all.latency.total / seconds,
+                    all.bytes_received / seconds / 1e6);
+    }
+    return all.latency.total > 0 ? 0 : 1;
+}
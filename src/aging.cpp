@@ -0,0 +1,154 @@
+#include "aging.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ECOSIM_X86 1
+#endif
+
+uint64_t age_block_scalar(const aging_rules_t &rules, const uint8_t *type, const int16_t *energy, int16_t *age)
+{
+    uint64_t dead = 0;
+    for (size_t k = 0; k < AGING_BLOCK; ++k)
+    {
+        const uint8_t t = type[k];
+        if (t == 0)
+            continue;
+        if (age[k] < INT16_MAX)
+            ++age[k];
+        if (age[k] > rules.maximum_age[t] || (rules.starves[t] && energy[k] <= 0))
+            dead |= 1ull << k;
+    }
+    return dead;
+}
+
+#ifdef ECOSIM_X86
+
+// Eight cells per step: types are widened to 16-bit lanes and the per-type
+// limits selected with compares, since SSE2 has no byte shuffle
+uint64_t age_block_sse2(const aging_rules_t &rules, const uint8_t *type, const int16_t *energy, int16_t *age)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i type_id[MAXIMUM_SPECIES + 1], limit[MAXIMUM_SPECIES + 1], starves[MAXIMUM_SPECIES + 1];
+    for (unsigned t = 1; t < rules.types; ++t)
+    {
+        type_id[t] = _mm_set1_epi16((int16_t)t);
+        limit[t] = _mm_set1_epi16(rules.maximum_age[t]);
+        starves[t] = _mm_set1_epi16(rules.starves[t] ? -1 : 0);
+    }
+
+    uint64_t dead = 0;
+    for (size_t k = 0; k < AGING_BLOCK; k += 8)
+    {
+        const __m128i types = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(type + k)), zero);
+        __m128i maximum = zero;
+        __m128i starving = zero;
+        for (unsigned t = 1; t < rules.types; ++t)
+        {
+            const __m128i is_type = _mm_cmpeq_epi16(types, type_id[t]);
+            maximum = _mm_or_si128(maximum, _mm_and_si128(is_type, limit[t]));
+            starving = _mm_or_si128(starving, _mm_and_si128(is_type, starves[t]));
+        }
+        const __m128i occupied = _mm_xor_si128(_mm_cmpeq_epi16(types, zero), _mm_set1_epi16(-1));
+
+        // Subtracting the all-ones mask adds one to occupied cells only
+        const __m128i aged = _mm_subs_epi16(_mm_loadu_si128((const __m128i *)(age + k)), occupied);
+        _mm_storeu_si128((__m128i *)(age + k), aged);
+
+        const __m128i fed = _mm_cmpgt_epi16(_mm_loadu_si128((const __m128i *)(energy + k)), zero);
+        const __m128i dies = _mm_and_si128(occupied, _mm_or_si128(_mm_cmpgt_epi16(aged, maximum),
+                                                                  _mm_andnot_si128(fed, starving)));
+        dead |= (uint64_t)_mm_movemask_epi8(_mm_packs_epi16(dies, zero)) << k;
+    }
+    return dead;
+}
+
+// Sixteen cells per step with the same selection as the SSE2 kernel
+__attribute__((target("avx2"))) uint64_t age_block_avx2(const aging_rules_t &rules, const uint8_t *type,
+                                                         const int16_t *energy, int16_t *age)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i type_id[MAXIMUM_SPECIES + 1], limit[MAXIMUM_SPECIES + 1], starves[MAXIMUM_SPECIES + 1];
+    for (unsigned t = 1; t < rules.types; ++t)
+    {
+        type_id[t] = _mm256_set1_epi16((int16_t)t);
+        limit[t] = _mm256_set1_epi16(rules.maximum_age[t]);
+        starves[t] = _mm256_set1_epi16(rules.starves[t] ? -1 : 0);
+    }
+
+    uint64_t dead = 0;
+    for (size_t k = 0; k < AGING_BLOCK; k += 16)
+    {
+        const __m256i types = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(type + k)));
+        __m256i maximum = zero;
+        __m256i starving = zero;
+        for (unsigned t = 1; t < rules.types; ++t)
+        {
+            const __m256i is_type = _mm256_cmpeq_epi16(types, type_id[t]);
+            maximum = _mm256_or_si256(maximum, _mm256_and_si256(is_type, limit[t]));
+            starving = _mm256_or_si256(starving, _mm256_and_si256(is_type, starves[t]));
+        }
+        const __m256i occupied = _mm256_xor_si256(_mm256_cmpeq_epi16(types, zero), _mm256_set1_epi16(-1));
+
+        const __m256i aged = _mm256_subs_epi16(_mm256_loadu_si256((const __m256i *)(age + k)), occupied);
+        _mm256_storeu_si256((__m256i *)(age + k), aged);
+
+        const __m256i fed = _mm256_cmpgt_epi16(_mm256_loadu_si256((const __m256i *)(energy + k)), zero);
+        const __m256i dies = _mm256_and_si256(occupied, _mm256_or_si256(_mm256_cmpgt_epi16(aged, maximum),
+                                                                        _mm256_andnot_si256(fed, starving)));
+        // Narrow the 16-bit lanes to bytes, keeping them in order
+        const __m128i packed = _mm_packs_epi16(_mm256_castsi256_si128(dies), _mm256_extracti128_si256(dies, 1));
+        dead |= (uint64_t)(uint16_t)_mm_movemask_epi8(packed) << k;
+    }
+    return dead;
+}
+
+#else
+
+uint64_t age_block_sse2(const aging_rules_t &rules, const uint8_t *type, const int16_t *energy, int16_t *age)
+{
+    return age_block_scalar(rules, type, energy, age);
+}
+
+uint64_t age_block_avx2(const aging_rules_t &rules, const uint8_t *type, const int16_t *energy, int16_t *age)
+{
+    return age_block_scalar(rules, type, energy, age);
+}
+
+#endif
+
+namespace
+{
+    struct aging_choice_t
+    {
+        aging_kernel_t kernel;
+        const char *name;
+    };
+
+    aging_choice_t choose_aging_kernel()
+    {
+#ifdef ECOSIM_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return {age_block_avx2, "avx2"};
+        if (__builtin_cpu_supports("sse2"))
+            return {age_block_sse2, "sse2"};
+#endif
+        return {age_block_scalar, "scalar"};
+    }
+
+    const aging_choice_t &aging_choice()
+    {
+        static const aging_choice_t choice = choose_aging_kernel();
+        return choice;
+    }
+}
+
+aging_kernel_t aging_kernel()
+{
+    return aging_choice().kernel;
+}
+
+const char *aging_kernel_name()
+{
+    return aging_choice().name;
+}
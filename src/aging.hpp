@@ -0,0 +1,31 @@
+#pragma once
+
+#include "grid.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+// Cells handled by one call of an aging kernel, one occupancy bitmap word
+const size_t AGING_BLOCK = 64;
+
+// Per-type limits checked when entities age, indexed by entity type
+struct aging_rules_t
+{
+    unsigned types = 1; // Entity types in use, empty included
+    int16_t maximum_age[MAXIMUM_SPECIES + 1] = {};
+    bool starves[MAXIMUM_SPECIES + 1] = {}; // Dies once its energy drops to zero
+};
+
+// Adds one tick of age to every occupied cell among AGING_BLOCK consecutive cells and
+// returns a bit per cell that reached its maximum age or starved. Only the
+// age plane is written, the caller clears the cells that died.
+using aging_kernel_t = uint64_t (*)(const aging_rules_t &rules, const uint8_t *type, const int16_t *energy,
+                                    int16_t *age);
+
+uint64_t age_block_scalar(const aging_rules_t &rules, const uint8_t *type, const int16_t *energy, int16_t *age);
+uint64_t age_block_sse2(const aging_rules_t &rules, const uint8_t *type, const int16_t *energy, int16_t *age);
+uint64_t age_block_avx2(const aging_rules_t &rules, const uint8_t *type, const int16_t *energy, int16_t *age);
+
+// Fastest kernel the running CPU supports, picked once
+aging_kernel_t aging_kernel();
+const char *aging_kernel_name();
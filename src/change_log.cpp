@@ -0,0 +1,61 @@
+#include "change_log.hpp"
+
+#include <algorithm>
+
+void change_log_t::reset(size_t cells)
+{
+    for (entry_t &entry : entries_)
+        entry.cells.clear();
+    count_ = 0;
+    first_ = 0;
+    entries_total_ = 0;
+    cells_ = cells;
+}
+
+void change_log_t::append(uint64_t tick, const std::vector<std::vector<uint32_t>> &lists)
+{
+    // Reuse the oldest slot when the ring is full
+    if (count_ == CHANGE_LOG_TICKS)
+    {
+        entries_total_ -= entries_[first_].cells.size();
+        first_ = (first_ + 1) % CHANGE_LOG_TICKS;
+        --count_;
+    }
+
+    entry_t &entry = entries_[(first_ + count_) % CHANGE_LOG_TICKS];
+    entry.tick = tick;
+    entry.cells.clear();
+    for (const std::vector<uint32_t> &list : lists)
+        entry.cells.insert(entry.cells.end(), list.begin(), list.end());
+    entries_total_ += entry.cells.size();
+    ++count_;
+
+    while (count_ > 1 && entries_total_ > cells_)
+    {
+        entries_total_ -= entries_[first_].cells.size();
+        entries_[first_].cells.clear();
+        first_ = (first_ + 1) % CHANGE_LOG_TICKS;
+        --count_;
+    }
+}
+
+bool change_log_t::changed_since(uint64_t base_tick, uint64_t current_tick, std::vector<uint32_t> &cells) const
+{
+    cells.clear();
+    if (base_tick > current_tick)
+        return false;
+    if (base_tick == current_tick)
+        return true;
+    if (count_ == 0 || entries_[first_].tick > base_tick + 1)
+        return false;
+
+    for (size_t k = 0; k < count_; ++k)
+    {
+        const entry_t &entry = entries_[(first_ + k) % CHANGE_LOG_TICKS];
+        if (entry.tick > base_tick)
+            cells.insert(cells.end(), entry.cells.begin(), entry.cells.end());
+    }
+    std::sort(cells.begin(), cells.end());
+    cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+    return true;
+}
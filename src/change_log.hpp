@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Number of past ticks whose changed cells are remembered
+const size_t CHANGE_LOG_TICKS = 64;
+
+// Ring buffer with the cells written during each of the last ticks, used to
+// answer "what changed since tick N" without comparing whole grids. Older
+// ticks are dropped once the log holds more entries than the grid has cells,
+// since a full frame is cheaper than such a delta anyway.
+class change_log_t
+{
+public:
+    void reset(size_t cells);
+
+    // Records the cells written during the given tick, in any order and with repetitions
+    void append(uint64_t tick, const std::vector<std::vector<uint32_t>> &lists);
+
+    // Fills cells with the sorted set of cells changed after base_tick up to the
+    // latest recorded tick. Returns false when the log does not reach back that far.
+    bool changed_since(uint64_t base_tick, uint64_t current_tick, std::vector<uint32_t> &cells) const;
+
+    // Cells of the most recent tick, empty when nothing was recorded yet
+    const std::vector<uint32_t> &latest() const
+    {
+        return entries_[(first_ + count_ + CHANGE_LOG_TICKS - 1) % CHANGE_LOG_TICKS].cells;
+    }
+
+private:
+    struct entry_t
+    {
+        uint64_t tick = 0;
+        std::vector<uint32_t> cells;
+    };
+
+    entry_t entries_[CHANGE_LOG_TICKS];
+    size_t count_ = 0;   // Valid entries, the newest at (first_ + count_ - 1)
+    size_t first_ = 0;   // Slot of the oldest valid entry
+    size_t entries_total_ = 0;
+    size_t cells_ = 0;
+};
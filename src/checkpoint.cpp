@@ -0,0 +1,348 @@
+#include "checkpoint.hpp"
+#include "config.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Checkpoint layout, all integers little-endian and doubles as their IEEE bits:
+//
+//   offset  size  field
+//   0       4     magic "ECCK"
+//   4       2     format version (CHECKPOINT_VERSION)
+//   6       1     flags (CHECKPOINT_FLAG_TOROIDAL, CHECKPOINT_FLAG_BACKGROUND)
+//   7       1     neighborhood, 4 or 8
+//   8       4     width
+//   12      4     height
+//   16      8     tick
+//   24      8     seed
+//   32      8     tick rate
+//   40      4     species count
+//   44      4     reserved, 0
+//   48      ...   species records, in table order
+//   ...     n     type plane, one byte per cell in row-major order
+//   ...     2n    energy plane, int16 per cell
+//   ...     2n    age plane, int16 per cell
+//
+// A species record is its name length (2 bytes) and name, then symbol,
+// uses_energy, eats_all and eat_range (1 byte each), prey (2), maximum_age,
+// initial_energy, energy_gain, move_cost, reproduction_threshold,
+// reproduction_cost and offspring_energy (4 each), and eat_probability,
+// move_probability and reproduction_probability (8 each).
+namespace
+{
+    const char CHECKPOINT_MAGIC[4] = {'E', 'C', 'C', 'K'};
+    const uint16_t CHECKPOINT_VERSION = 1;
+    const uint8_t CHECKPOINT_FLAG_TOROIDAL = 1;
+    const uint8_t CHECKPOINT_FLAG_BACKGROUND = 2;
+
+    // Planes of big-endian hosts are converted through a buffer of this many values
+    const size_t SWAP_CHUNK = 1 << 16;
+
+    template <typename T>
+    void put_le(std::string &out, T value)
+    {
+        for (size_t b = 0; b < sizeof(T); ++b)
+            out += (char)((uint64_t)value >> (8 * b));
+    }
+
+    void put_double(std::string &out, double value)
+    {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        put_le(out, bits);
+    }
+
+    // Little-endian fields read in sequence, remembering whether the file ended early
+    struct reader_t
+    {
+        std::FILE *file;
+        bool failed = false;
+
+        template <typename T>
+        T get()
+        {
+            uint8_t bytes[sizeof(T)] = {};
+            failed |= std::fread(bytes, 1, sizeof(T), file) != sizeof(T);
+            uint64_t value = 0;
+            for (size_t b = 0; b < sizeof(T); ++b)
+                value |= (uint64_t)bytes[b] << (8 * b);
+            return (T)value;
+        }
+
+        double get_double()
+        {
+            const uint64_t bits = get<uint64_t>();
+            double value;
+            std::memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+        std::string get_string(size_t length)
+        {
+            std::string text(length, '\0');
+            failed |= std::fread(&text[0], 1, length, file) != length;
+            return text;
+        }
+    };
+
+    bool write_all(int fd, const void *data, size_t bytes)
+    {
+        const char *p = static_cast<const char *>(data);
+        while (bytes > 0)
+        {
+            const ssize_t written = ::write(fd, p, bytes);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            p += written;
+            bytes -= (size_t)written;
+        }
+        return true;
+    }
+
+    bool write_plane(int fd, const std::vector<int16_t> &plane)
+    {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        return write_all(fd, plane.data(), plane.size() * sizeof(int16_t));
+#else
+        std::vector<uint8_t> chunk(SWAP_CHUNK * 2);
+        for (size_t first = 0; first < plane.size(); first += SWAP_CHUNK)
+        {
+            const size_t count = std::min(SWAP_CHUNK, plane.size() - first);
+            for (size_t k = 0; k < count; ++k)
+            {
+                chunk[2 * k] = (uint8_t)plane[first + k];
+                chunk[2 * k + 1] = (uint8_t)((uint16_t)plane[first + k] >> 8);
+            }
+            if (!write_all(fd, chunk.data(), count * 2))
+                return false;
+        }
+        return true;
+#endif
+    }
+
+    bool read_plane(std::FILE *file, std::vector<int16_t> &plane)
+    {
+        if (std::fread(plane.data(), sizeof(int16_t), plane.size(), file) != plane.size())
+            return false;
+#if !(defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+        for (int16_t &value : plane)
+        {
+            const uint16_t raw = (uint16_t)value;
+            value = (int16_t)(uint16_t)(raw >> 8 | raw << 8);
+        }
+#endif
+        return true;
+    }
+
+    std::string system_error(const char *what, const std::string &path)
+    {
+        return std::string(what) + " " + path + ": " + std::strerror(errno);
+    }
+
+    // Makes the rename itself durable. Failing here only weakens durability,
+    // the checkpoint is already in place.
+    void sync_directory(const std::string &path)
+    {
+        const size_t slash = path.rfind('/');
+        const std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+        const int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd >= 0)
+        {
+            ::fsync(fd);
+            ::close(fd);
+        }
+    }
+}
+
+size_t write_checkpoint(const snapshot_t &snapshot, const std::string &path, std::string &error)
+{
+    if (!snapshot.config)
+    {
+        error = "The simulation was never started";
+        return 0;
+    }
+    const simulation_config_t &config = *snapshot.config;
+    const grid_t &grid = snapshot.grid;
+
+    std::string header;
+    header.append(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    put_le(header, CHECKPOINT_VERSION);
+    put_le(header, (uint8_t)((config.topology.toroidal ? CHECKPOINT_FLAG_TOROIDAL : 0) |
+                             (config.background ? CHECKPOINT_FLAG_BACKGROUND : 0)));
+    put_le(header, (uint8_t)config.topology.neighborhood);
+    put_le(header, grid.width);
+    put_le(header, grid.height);
+    put_le(header, snapshot.tick);
+    put_le(header, snapshot.seed);
+    put_double(header, config.tick_rate);
+    put_le(header, (uint32_t)config.species.size());
+    put_le(header, (uint32_t)0);
+    for (const species_t &s : config.species.species)
+    {
+        put_le(header, (uint16_t)s.name.size());
+        header += s.name;
+        put_le(header, (uint8_t)s.symbol);
+        put_le(header, (uint8_t)s.uses_energy);
+        put_le(header, (uint8_t)s.eats_all);
+        put_le(header, (uint8_t)s.eat_range);
+        put_le(header, s.prey);
+        for (int32_t value : {s.maximum_age, s.initial_energy, s.energy_gain, s.move_cost,
+                              s.reproduction_threshold, s.reproduction_cost, s.offspring_energy})
+            put_le(header, (uint32_t)value);
+        put_double(header, s.eat_probability);
+        put_double(header, s.move_probability);
+        put_double(header, s.reproduction_probability);
+    }
+
+    // Concurrent writers of the same checkpoint each get their own temporary file
+    static std::atomic<uint64_t> writes{0};
+    const std::string temporary = path + ".tmp" + std::to_string(writes++);
+    const int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        error = system_error("Cannot create", temporary);
+        return 0;
+    }
+    bool written = write_all(fd, header.data(), header.size()) &&
+                   write_all(fd, grid.type.data(), grid.type.size()) && write_plane(fd, grid.energy) &&
+                   write_plane(fd, grid.age) && ::fsync(fd) == 0;
+    if (!written)
+        error = system_error("Cannot write", temporary);
+    if (::close(fd) != 0 && written)
+    {
+        written = false;
+        error = system_error("Cannot write", temporary);
+    }
+    if (written && std::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        written = false;
+        error = system_error("Cannot rename to", path);
+    }
+    if (!written)
+    {
+        std::remove(temporary.c_str());
+        return 0;
+    }
+    sync_directory(path);
+    return header.size() + grid.size() * 5;
+}
+
+bool read_checkpoint(const std::string &path, checkpoint_t &checkpoint, std::string &error)
+{
+    std::FILE *file = std::fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        error = system_error("Cannot open", path);
+        return false;
+    }
+    reader_t in{file};
+    const bool valid = [&]
+    {
+        char magic[sizeof(CHECKPOINT_MAGIC)];
+        if (std::fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+            std::memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0)
+        {
+            error = "Not a checkpoint";
+            return false;
+        }
+        if (in.get<uint16_t>() != CHECKPOINT_VERSION)
+        {
+            error = "Unsupported checkpoint version";
+            return false;
+        }
+
+        simulation_config_t &config = checkpoint.config;
+        const uint8_t flags = in.get<uint8_t>();
+        config.topology.toroidal = flags & CHECKPOINT_FLAG_TOROIDAL;
+        config.background = flags & CHECKPOINT_FLAG_BACKGROUND;
+        config.topology.neighborhood = in.get<uint8_t>();
+        config.width = in.get<uint32_t>();
+        config.height = in.get<uint32_t>();
+        checkpoint.tick = in.get<uint64_t>();
+        config.seed = in.get<uint64_t>();
+        config.tick_rate = in.get_double();
+        const uint32_t species = in.get<uint32_t>();
+        in.get<uint32_t>();
+        if (in.failed)
+        {
+            error = "Truncated checkpoint";
+            return false;
+        }
+        if (config.width == 0 || config.height == 0 || config.width > MAXIMUM_GRID_SIZE ||
+            config.height > MAXIMUM_GRID_SIZE ||
+            (config.topology.neighborhood != 4 && config.topology.neighborhood != 8) ||
+            (config.topology.toroidal && (config.width < 3 || config.height < 3)) || !(config.tick_rate >= 0) ||
+            species == 0 || species > MAXIMUM_SPECIES)
+        {
+            error = "Invalid checkpoint header";
+            return false;
+        }
+
+        // Prey may only be entity types of this table
+        const uint32_t types = ((1u << species) - 1) << 1;
+        config.counts.clear();
+        config.species.species.assign(species, species_t());
+        for (uint32_t k = 0; k < species && !in.failed; ++k)
+        {
+            species_t &s = config.species.species[k];
+            s.name = in.get_string(in.get<uint16_t>());
+            s.symbol = (char)in.get<uint8_t>();
+            s.uses_energy = in.get<uint8_t>() != 0;
+            s.eats_all = in.get<uint8_t>() != 0;
+            s.eat_range = in.get<uint8_t>();
+            s.prey = in.get<uint16_t>();
+            for (int32_t *value : {&s.maximum_age, &s.initial_energy, &s.energy_gain, &s.move_cost,
+                                   &s.reproduction_threshold, &s.reproduction_cost, &s.offspring_energy})
+                *value = (int32_t)in.get<uint32_t>();
+            s.eat_probability = in.get_double();
+            s.move_probability = in.get_double();
+            s.reproduction_probability = in.get_double();
+            if (!in.failed && (s.name.empty() || config.species.find(s.name) != k + 1 || (s.prey & ~types)))
+            {
+                error = "Invalid species " + s.name;
+                return false;
+            }
+        }
+        if (in.failed)
+        {
+            error = "Truncated checkpoint";
+            return false;
+        }
+        return check_species(config.species, error);
+    }();
+
+    // The planes fill the rest of the file
+    grid_t &grid = checkpoint.grid;
+    bool complete = false;
+    if (valid)
+    {
+        grid.assign(checkpoint.config.width, checkpoint.config.height);
+        complete = std::fread(grid.type.data(), 1, grid.size(), file) == grid.size() &&
+                   read_plane(file, grid.energy) && read_plane(file, grid.age) && std::fgetc(file) == EOF;
+        if (!complete)
+            error = "Truncated checkpoint";
+    }
+    std::fclose(file);
+    if (!complete)
+        return false;
+
+    const size_t types = checkpoint.config.species.size();
+    for (uint8_t type : grid.type)
+    {
+        if (type > types)
+        {
+            error = "Invalid entity type in checkpoint";
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "simulation.hpp"
+
+#include <string>
+
+// Extension of checkpoint files, named after the session they hold
+const char CHECKPOINT_EXTENSION[] = ".ecosim";
+
+// A saved run: the settings it started with, less the initial counts and the
+// thread count, and the grid at the saved tick. The random stream only
+// depends on the seed and the tick, so this is all a run needs to go on.
+struct checkpoint_t
+{
+    simulation_config_t config;
+    uint64_t tick = 0;
+    grid_t grid;
+};
+
+// Writes the run of a published snapshot to path. The grid planes are written
+// straight from the snapshot, so the stepping thread is never involved. The
+// file goes through a temporary one in the same directory that is synced and
+// renamed over path, so a crash leaves either the old checkpoint or the new
+// one. Returns the bytes written, 0 with the reason in error on failure.
+size_t write_checkpoint(const snapshot_t &snapshot, const std::string &path, std::string &error);
+
+// Loads a checkpoint, rejecting truncated files and rules or grids a run
+// could not have had. Threads are left as they were in checkpoint.config.
+bool read_checkpoint(const std::string &path, checkpoint_t &checkpoint, std::string &error);
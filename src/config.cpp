@@ -0,0 +1,209 @@
+#include "config.hpp"
+
+#include <algorithm>
+#include <thread>
+
+unsigned maximum_threads()
+{
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+bool check_species(const species_table_t &table, std::string &error)
+{
+    // Energies are stored as 16-bit values, and symbols go unescaped into JSON
+    const auto in_range = [](int32_t value)
+    { return value >= INT16_MIN && value <= INT16_MAX; };
+    const auto probability = [](double value)
+    { return value >= 0 && value <= 1; };
+    const std::string symbols = table.symbols();
+    for (size_t k = 0; k < table.size(); ++k)
+    {
+        const species_t &s = table.species[k];
+        const bool valid = s.symbol > ' ' && s.symbol <= '~' && s.symbol != '"' && s.symbol != '\\' &&
+                           symbols.find(s.symbol) == k + 1 && s.maximum_age >= 0 && s.maximum_age <= INT16_MAX &&
+                           in_range(s.initial_energy) && in_range(s.energy_gain) && in_range(s.move_cost) &&
+                           in_range(s.reproduction_threshold) && in_range(s.reproduction_cost) &&
+                           in_range(s.offspring_energy) && (s.eat_range == 4 || s.eat_range == 8) &&
+                           probability(s.eat_probability) && probability(s.move_probability) &&
+                           probability(s.reproduction_probability);
+        if (!valid)
+        {
+            error = "Invalid rules for species " + s.name;
+            return false;
+        }
+    }
+
+    std::vector<unsigned> levels;
+    if (!table.trophic_levels(levels))
+    {
+        error = "The food web must not have cycles";
+        return false;
+    }
+    return true;
+}
+
+// Reads the "species" list of /start-simulation into a table and the initial
+// count of each species. Entries named after a classic species start from its
+// rules, the others from the defaults of species_t. Returns false with a
+// message in error when the list is invalid.
+static bool parse_species(const nlohmann::json &entries, species_table_t &table, std::vector<uint32_t> &counts,
+                          std::string &error)
+{
+    if (!entries.is_array() || entries.empty() || entries.size() > MAXIMUM_SPECIES)
+    {
+        error = "Species must be a list of 1 to " + std::to_string(MAXIMUM_SPECIES) + " entries";
+        return false;
+    }
+
+    table.species.clear();
+    counts.clear();
+    try
+    {
+        // Names first, so that "eats" may name species listed later
+        for (const nlohmann::json &entry : entries)
+        {
+            const std::string name = entry.at("name").get<std::string>();
+            if (name.empty() || table.find(name))
+            {
+                error = "Species names must be unique and not empty";
+                return false;
+            }
+            const unsigned classic = classic_species().find(name);
+            table.species.push_back(classic ? classic_species()[classic] : species_t());
+            table.species.back().name = name;
+        }
+
+        for (size_t k = 0; k < entries.size(); ++k)
+        {
+            const nlohmann::json &entry = entries[k];
+            species_t &s = table.species[k];
+            if (entry.contains("symbol"))
+            {
+                const std::string symbol = entry["symbol"].get<std::string>();
+                s.symbol = symbol.size() == 1 ? symbol[0] : '\0';
+            }
+            s.maximum_age = entry.value("maximum_age", s.maximum_age);
+            s.uses_energy = entry.value("uses_energy", s.uses_energy);
+            s.initial_energy = entry.value("initial_energy", s.initial_energy);
+            s.eat_probability = entry.value("eat_probability", s.eat_probability);
+            s.energy_gain = entry.value("energy_gain", s.energy_gain);
+            s.eat_range = entry.value("eat_range", s.eat_range);
+            s.eats_all = entry.value("eats_all", s.eats_all);
+            s.move_probability = entry.value("move_probability", s.move_probability);
+            s.move_cost = entry.value("move_cost", s.move_cost);
+            s.reproduction_probability = entry.value("reproduction_probability", s.reproduction_probability);
+            s.reproduction_threshold = entry.value("reproduction_threshold", s.reproduction_threshold);
+            s.reproduction_cost = entry.value("reproduction_cost", s.reproduction_cost);
+            s.offspring_energy = entry.value("offspring_energy", s.offspring_energy);
+
+            // Classic prey are inherited by name, the types may differ here
+            const uint16_t classic_prey = s.prey;
+            s.prey = 0;
+            for (unsigned type = 1; type <= classic_species().size(); ++type)
+                if (classic_prey >> type & 1)
+                    if (const unsigned prey = table.find(classic_species()[type].name))
+                        s.prey |= 1u << prey;
+            if (entry.contains("eats"))
+            {
+                s.prey = 0;
+                for (const nlohmann::json &prey : entry["eats"])
+                {
+                    const unsigned type = table.find(prey.get<std::string>());
+                    if (!type)
+                    {
+                        error = "Unknown prey " + prey.get<std::string>();
+                        return false;
+                    }
+                    s.prey |= 1u << type;
+                }
+            }
+            counts.push_back(entry.value("count", 0u));
+        }
+    }
+    catch (const nlohmann::json::exception &)
+    {
+        error = "Invalid species";
+        return false;
+    }
+
+    return check_species(table, error);
+}
+
+// parse_run_config without the handling of fields of the wrong type
+static bool read_run_config(const nlohmann::json &body, simulation_config_t &config, std::string &error)
+{
+    // Grid dimensions are optional and default to the classic 15x15 board
+    config.width = body.value("width", DEFAULT_GRID_SIZE);
+    config.height = body.value("height", DEFAULT_GRID_SIZE);
+    if (config.width == 0 || config.height == 0 || config.width > MAXIMUM_GRID_SIZE ||
+        config.height > MAXIMUM_GRID_SIZE)
+    {
+        error = "Invalid grid size";
+        return false;
+    }
+
+    // A species list replaces the classic plants, herbivores and carnivores
+    if (body.contains("species"))
+    {
+        if (!parse_species(body["species"], config.species, config.counts, error))
+            return false;
+    }
+    else
+    {
+        config.species = classic_species();
+        config.counts = {body.value("plants", 0u), body.value("herbivores", 0u), body.value("carnivores", 0u)};
+    }
+
+    uint64_t total_entities = 0;
+    for (uint32_t count : config.counts)
+        total_entities += count;
+    if (total_entities > (uint64_t)config.width * config.height)
+    {
+        error = "Too many entities";
+        return false;
+    }
+
+    // Edges are bounded and entities move to the 4 orthogonal neighbors unless asked otherwise
+    const std::string edges = body.value("edges", std::string("bounded"));
+    config.topology.toroidal = edges == "toroidal";
+    config.topology.neighborhood = body.value("neighborhood", 4u);
+    if ((!config.topology.toroidal && edges != "bounded") ||
+        (config.topology.neighborhood != 4 && config.topology.neighborhood != 8))
+    {
+        error = "Invalid topology";
+        return false;
+    }
+    if (config.topology.toroidal && (config.width < 3 || config.height < 3))
+    {
+        error = "Toroidal grids must be at least 3x3";
+        return false;
+    }
+
+    // Runs are reproducible from the seed
+    config.seed = body.value("seed", config.seed);
+    config.threads = body.value("threads", config.threads);
+    if (config.threads == 0 || config.threads > maximum_threads())
+    {
+        error = "Threads must be between 1 and " + std::to_string(maximum_threads());
+        return false;
+    }
+    return true;
+}
+
+bool parse_run_config(const nlohmann::json &body, simulation_config_t &config, std::string &error)
+{
+    if (!body.is_object())
+    {
+        error = "The body must be a JSON object";
+        return false;
+    }
+    try
+    {
+        return read_run_config(body, config, error);
+    }
+    catch (const nlohmann::json::exception &)
+    {
+        error = "Invalid simulation parameters";
+        return false;
+    }
+}
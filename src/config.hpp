@@ -0,0 +1,26 @@
+#pragma once
+
+#include "json.hpp"
+#include "simulation.hpp"
+
+#include <string>
+
+// Grid dimensions
+const uint32_t DEFAULT_GRID_SIZE = 15;
+const uint32_t MAXIMUM_GRID_SIZE = 16384;
+
+// Most threads a run may step with: one per hardware thread, since more only
+// adds contention and every one of them is a real thread kept for the run
+unsigned maximum_threads();
+
+// Checks the rules of every species and that the food web has no cycles.
+// Returns false with a message in error when a run could not use the table.
+bool check_species(const species_table_t &table, std::string &error);
+
+// Reads the description of a run from a /start-simulation body: grid size,
+// species and their initial counts (0 for a missing classic count), topology,
+// seed and threads. The seed and
+// threads keep the values config already holds when the body has none, and
+// the fields that only make sense to the server are left alone. Returns false
+// with a message in error when the run is invalid.
+bool parse_run_config(const nlohmann::json &body, simulation_config_t &config, std::string &error);
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Type definitions. A cell's type is 0 when empty, otherwise the 1-based
+// index of its species in the run's species table; the names below are the
+// types of the classic table.
+enum entity_type_t : uint8_t
+{
+    empty,
+    plant,
+    herbivore,
+    carnivore
+};
+
+// Largest number of species in one run
+const unsigned MAXIMUM_SPECIES = 15;
+
+struct entity_t
+{
+    entity_type_t type;
+    int32_t energy;
+    int32_t age;
+};
+
+// Number of entities of each type, indexed by type, with one entry per
+// species of the run after the unused one for empty cells
+using population_t = std::vector<uint32_t>;
+
+// Energy and age are stored as 16-bit values, saturate instead of wrapping
+inline int16_t saturate_int16(int32_t value)
+{
+    return (int16_t)std::min<int32_t>(std::max<int32_t>(value, INT16_MIN), INT16_MAX);
+}
+
+// Row-major grid stored as structure-of-arrays: one plane per entity field,
+// so passes that only look at the type read one byte per cell
+struct grid_t
+{
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<uint8_t> type;
+    std::vector<int16_t> energy;
+    std::vector<int16_t> age;
+
+    void assign(uint32_t w, uint32_t h)
+    {
+        width = w;
+        height = h;
+        type.assign((size_t)w * h, empty);
+        energy.assign((size_t)w * h, 0);
+        age.assign((size_t)w * h, 0);
+    }
+
+    size_t size() const { return type.size(); }
+    size_t index(uint32_t i, uint32_t j) const { return (size_t)i * width + j; }
+    bool contains(uint32_t i, uint32_t j) const { return i < height && j < width; }
+
+    entity_t get(size_t idx) const { return {(entity_type_t)type[idx], energy[idx], age[idx]}; }
+
+    void set(size_t idx, entity_type_t t, int32_t e, int32_t a)
+    {
+        type[idx] = t;
+        energy[idx] = saturate_int16(e);
+        age[idx] = saturate_int16(a);
+    }
+
+    void clear(size_t idx) { set(idx, empty, 0, 0); }
+
+    void copy_cell(const grid_t &from, size_t idx)
+    {
+        type[idx] = from.type[idx];
+        energy[idx] = from.energy[idx];
+        age[idx] = from.age[idx];
+    }
+};
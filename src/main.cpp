@@ -1,73 +1,355 @@
 #define CROW_MAIN
 #define CROW_STATIC_DIR "../public"
 
+#include "checkpoint.hpp"
+#include "config.hpp"
 #include "crow_all.h"
 #include "json.hpp"
+#include "metrics.hpp"
+#include "serialize.hpp"
+#include "session.hpp"
+#include "stream.hpp"
+#include <cstdlib>
+#include <filesystem>
 #include <random>
 
-static const uint32_t NUM_ROWS = 15;
-
-// Constants
-const uint32_t PLANT_MAXIMUM_AGE = 10;
-const uint32_t HERBIVORE_MAXIMUM_AGE = 50;
-const uint32_t CARNIVORE_MAXIMUM_AGE = 80;
-const uint32_t MAXIMUM_ENERGY = 200;
-const uint32_t THRESHOLD_ENERGY_FOR_REPRODUCTION = 20;
-
-// Probabilities
-const double PLANT_REPRODUCTION_PROBABILITY = 0.2;
-const double HERBIVORE_REPRODUCTION_PROBABILITY = 0.075;
-const double CARNIVORE_REPRODUCTION_PROBABILITY = 0.025;
-const double HERBIVORE_MOVE_PROBABILITY = 0.7;
-const double HERBIVORE_EAT_PROBABILITY = 0.9;
-const double CARNIVORE_MOVE_PROBABILITY = 0.5;
-const double CARNIVORE_EAT_PROBABILITY = 1.0;
-
-// Type definitions
-enum entity_type_t
+// Session limits
+static const size_t MAXIMUM_SESSION_MEMORY = (size_t)2 << 30;
+static const std::chrono::seconds SESSION_IDLE_TIMEOUT{10 * 60};
+
+// Threads stepping each session unless the request asks for more. Sessions
+// already run in parallel with each other, and a pool per session sized to
+// the machine would leave hundreds of sessions with thousands of idle threads.
+static const unsigned DEFAULT_SESSION_THREADS = 1;
+
+// Largest number of ticks a single /next-iteration?steps=N may run
+static const uint32_t MAXIMUM_BATCH_STEPS = 1000000;
+
+// WebSocket subscribers of /stream, declared first since the sessions notify it until they stop
+static stream_hub_t stream_hub;
+
+// Checkpoints live in ECOSIM_CHECKPOINT_DIR, ./checkpoints by default, one
+// file per session named after its id
+static std::string checkpoint_directory()
 {
-    empty,
-    plant,
-    herbivore,
-    carnivore
-};
+    const char *directory = std::getenv("ECOSIM_CHECKPOINT_DIR");
+    return directory && *directory ? directory : "checkpoints";
+}
 
-struct pos_t
+static std::string checkpoint_path(const std::string &id)
 {
-    uint32_t i;
-    uint32_t j;
-};
+    return checkpoint_directory() + "/" + id + CHECKPOINT_EXTENSION;
+}
+
+// Sessions dropped for being idle are not brought back by the next start
+static void forget_checkpoint(const std::string &id)
+{
+    std::error_code ignored;
+    std::filesystem::remove(checkpoint_path(id), ignored);
+}
+
+// Independent simulations, each stepped on request or by its own thread
+static session_registry_t sessions(MAXIMUM_SESSION_MEMORY, SESSION_IDLE_TIMEOUT, forget_checkpoint);
+
+// Requests answered by each endpoint, exposed on /metrics
+static request_metrics_t request_metrics;
+
+// Label of a request path on /metrics. Static files and unknown paths share
+// one label, so clients cannot grow the label set.
+static const char *endpoint_label(const std::string &url)
+{
+    static const char *const endpoints[] = {"/", "/start-simulation", "/next-iteration", "/next-iteration.bin",
+                                            "/stream", "/metrics", "/checkpoint", "/restore"};
+    for (const char *endpoint : endpoints)
+        if (url == endpoint)
+            return endpoint;
+    return "other";
+}
 
-struct entity_t
+// Counts and times every request, from routing to the end of the handler
+struct metrics_middleware_t
 {
-    entity_type_t type;
-    int32_t energy;
-    int32_t age;
+    struct context
+    {
+        std::chrono::steady_clock::time_point start;
+    };
+
+    void before_handle(crow::request &, crow::response &, context &ctx)
+    {
+        ctx.start = std::chrono::steady_clock::now();
+    }
+
+    void after_handle(crow::request &req, crow::response &res, context &ctx)
+    {
+        request_metrics.record(endpoint_label(req.url), res.code, std::chrono::steady_clock::now() - ctx.start);
+    }
 };
 
-// Auxiliary code to convert the entity_type_t enum to a string
-NLOHMANN_JSON_SERIALIZE_ENUM(entity_type_t, {
-                                                {empty, " "},
-                                                {plant, "P"},
-                                                {herbivore, "H"},
-                                                {carnivore, "C"},
-                                            })
+// Live sessions with their tick and the population of each species
+static void write_session_metrics(std::string &out)
+{
+    const std::vector<std::shared_ptr<session_t>> live = sessions.list();
+    out += "# HELP ecosim_sessions Live simulation sessions.\n"
+           "# TYPE ecosim_sessions gauge\n"
+           "ecosim_sessions " + std::to_string(live.size()) + "\n"
+           "# HELP ecosim_session_memory_bytes Memory reserved by the grids of all sessions.\n"
+           "# TYPE ecosim_session_memory_bytes gauge\n"
+           "ecosim_session_memory_bytes " + std::to_string(sessions.memory()) + "\n";
+
+    std::string ticks, populations;
+    for (const std::shared_ptr<session_t> &session : live) {
+        std::shared_ptr<const snapshot_t> snapshot = session->simulation.snapshot();
+        if (!snapshot || !snapshot->config)
+            continue;
+        const std::string label = "session=\"" + session->id + "\"";
+        ticks += "ecosim_tick{" + label + "} " + std::to_string(snapshot->tick) + "\n";
+        for (unsigned type = 1; type < snapshot->population.size(); ++type)
+            populations += "ecosim_population{" + label + ",species=\"" +
+                           prometheus_label(snapshot->config->species[type].name) + "\"} " +
+                           std::to_string(snapshot->population[type]) + "\n";
+    }
+    out += "# HELP ecosim_tick Last published tick of each session.\n"
+           "# TYPE ecosim_tick gauge\n" + ticks +
+           "# HELP ecosim_population Entities of each species at the last published tick.\n"
+           "# TYPE ecosim_population gauge\n" + populations;
+}
+
+// Every publish wakes the stream subscribers and counts as an access, so a
+// session stepping in the background is not evicted as idle. Set once, when
+// the session is created.
+static void watch_session(session_t &session)
+{
+    session.simulation.set_listener([&session]
+                                    {
+        session.touch();
+        stream_hub.notify(); });
+}
+
+// Session named by ?session=<id> or the X-Ecosim-Session header, answers 404 when unknown
+static std::shared_ptr<session_t> find_session(const crow::request &req, crow::response &res)
+{
+    const char *id = req.url_params.get("session");
+    std::shared_ptr<session_t> session = sessions.find(id ? std::string(id) : req.get_header_value("X-Ecosim-Session"));
+    if (!session) {
+        res.code = 404;
+        res.body = "Unknown session";
+        res.end();
+    }
+    return session;
+}
+
+// Ids become file names, so only the characters they are made of are accepted
+static bool valid_session_id(const std::string &id)
+{
+    return !id.empty() && id.size() <= 64 && id.find_first_not_of("0123456789abcdef") == std::string::npos;
+}
+
+// Writes a published state of the session to its checkpoint, returns the bytes written or 0
+static size_t save_session(const session_t &session, const snapshot_t &snapshot, std::string &error)
+{
+    scoped_timer_t timer(PHASE_CHECKPOINT);
+    std::error_code ignored;
+    std::filesystem::create_directories(checkpoint_directory(), ignored);
+    return write_checkpoint(snapshot, checkpoint_path(session.id), error);
+}
+
+// Resumes the session saved under the given id, under that same id, and
+// returns its first snapshot. On failure returns null with the HTTP status
+// and the reason.
+static std::shared_ptr<const snapshot_t> restore_session(const std::string &id, int &code, std::string &error)
+{
+    checkpoint_t checkpoint;
+    if (!read_checkpoint(checkpoint_path(id), checkpoint, error)) {
+        code = std::filesystem::exists(checkpoint_path(id)) ? 500 : 404;
+        return nullptr;
+    }
+    // Runs are deterministic whatever the thread count, so none is saved
+    checkpoint.config.threads = DEFAULT_SESSION_THREADS;
+
+    bool created = false;
+    std::shared_ptr<session_t> session = sessions.find_or_create(id, created);
+    if (created)
+        watch_session(*session);
+    std::lock_guard<std::mutex> lock(session->mutex);
+    if (!sessions.reserve(*session, checkpoint.config.width, checkpoint.config.height)) {
+        if (created)
+            sessions.erase(id);
+        code = 503;
+        error = "Simulation memory limit reached";
+        return nullptr;
+    }
+    return session->simulation.restore(checkpoint.config, checkpoint.tick, checkpoint.grid);
+}
+
+// Brings back every session found in the checkpoint directory
+static void restore_sessions()
+{
+    std::error_code failure;
+    for (const std::filesystem::directory_entry &entry :
+         std::filesystem::directory_iterator(checkpoint_directory(), failure)) {
+        const std::filesystem::path &path = entry.path();
+        const std::string id = path.stem().string();
+        if (path.extension() != CHECKPOINT_EXTENSION || !valid_session_id(id))
+            continue;
+        int code = 0;
+        std::string error;
+        if (std::shared_ptr<const snapshot_t> snapshot = restore_session(id, code, error)) {
+            CROW_LOG_INFO << "Restored session " << id << " at tick " << snapshot->tick;
+        } else {
+            CROW_LOG_WARNING << "Cannot restore session " << id << ": " << error;
+        }
+    }
+}
+
+// Periodic checkpoints, enabled by ECOSIM_CHECKPOINT_INTERVAL in seconds
+static std::mutex checkpointer_mutex;
+static std::condition_variable checkpointer_wake;
+static bool checkpointer_stopping = false;
+
+// Saves the sessions whose published tick moved since their last checkpoint
+static void save_sessions(std::unordered_map<std::string, std::pair<uint64_t, uint64_t>> &saved)
+{
+    std::unordered_map<std::string, std::pair<uint64_t, uint64_t>> live;
+    for (const std::shared_ptr<session_t> &session : sessions.list()) {
+        std::shared_ptr<const snapshot_t> snapshot = session->simulation.snapshot();
+        if (!snapshot->config || session->evicted)
+            continue;
+        // Run and tick of the state saved, a restart at the same tick is still new
+        const std::pair<uint64_t, uint64_t> state(snapshot->run, snapshot->tick);
+        auto last = saved.find(session->id);
+        std::string error;
+        if ((last != saved.end() && last->second == state) || save_session(*session, *snapshot, error)) {
+            live[session->id] = state;
+        } else {
+            CROW_LOG_WARNING << "Cannot checkpoint session " << session->id << ": " << error;
+        }
+        // An eviction during the save already removed the file, which the save brought back
+        if (session->evicted)
+            forget_checkpoint(session->id);
+    }
+    saved.swap(live);
+}
+
+// Checkpoints every interval until stopped, and once more on the way out
+static void run_checkpointer(std::chrono::seconds interval)
+{
+    std::unordered_map<std::string, std::pair<uint64_t, uint64_t>> saved;
+    std::unique_lock<std::mutex> lock(checkpointer_mutex);
+    while (!checkpointer_wake.wait_for(lock, interval, []
+                                       { return checkpointer_stopping; }))
+        save_sessions(saved);
+    save_sessions(saved);
+}
+
+// Clients that accept application/octet-stream get binary frames, everyone else JSON
+static bool wants_binary(const crow::request &req)
+{
+    return req.get_header_value("Accept").find(FRAME_CONTENT_TYPE) != std::string::npos;
+}
+
+static void send_grid(crow::response &res, const snapshot_t &snapshot, bool binary)
+{
+    res.set_header("X-Ecosim-Run", std::to_string(snapshot.run));
+    {
+        scoped_timer_t timer(PHASE_ENCODE);
+        if (binary) {
+            res.set_header("Content-Type", FRAME_CONTENT_TYPE);
+            res.body = grid_to_binary(snapshot.grid, snapshot.tick);
+        } else {
+            res.body = grid_to_json(snapshot.grid, snapshot.symbols);
+        }
+    }
+    res.end();
+}
+
+// Base of a delta, ?since=<run>:<tick> with the run from the X-Ecosim-Run
+// header of the frame the client holds. A bare tick names no run, runs count
+// from 1, so it gets a keyframe: it may come from before a restart.
+static void parse_since(const char *since, uint64_t &run, uint64_t &tick)
+{
+    char *end;
+    run = std::strtoull(since, &end, 10);
+    if (*end == ':') {
+        tick = std::strtoull(end + 1, nullptr, 10);
+    } else {
+        tick = run;
+        run = 0;
+    }
+}
 
-// Auxiliary code to convert the entity_t struct to a JSON object
-namespace nlohmann
+static void send_delta(crow::response &res, const snapshot_t &snapshot, bool binary, const char *since)
 {
-    void to_json(nlohmann::json &j, const entity_t &e)
+    res.set_header("X-Ecosim-Run", std::to_string(snapshot.run));
+    if (binary)
+        res.set_header("Content-Type", FRAME_CONTENT_TYPE);
     {
-        j = nlohmann::json{{"type", e.type}, {"energy", e.energy}, {"age", e.age}};
+        scoped_timer_t timer(PHASE_ENCODE);
+        uint64_t run, tick;
+        parse_since(since, run, tick);
+        write_snapshot_frame(snapshot, run, tick, binary, res.body);
     }
+    res.end();
+}
+
+// Full grid by default, deltas when the request carries ?since=<run>:<tick>
+static void send_frame(const crow::request &req, crow::response &res, const snapshot_t &snapshot, bool binary)
+{
+    const char *since = req.url_params.get("since");
+    if (since)
+        send_delta(res, snapshot, binary, since);
+    else
+        send_grid(res, snapshot, binary);
 }
 
-// Grid that contains the entities
-static std::vector<std::vector<entity_t>> entity_grid;
+// Runs ?steps=N ticks (1 by default) and answers with the final frame only.
+// With ?populations=1 the answer is a JSON object that also lists the
+// population after each tick, so a long run needs no per-tick frames.
+static void advance_and_send(const crow::request &req, crow::response &res, bool binary, bool allow_populations)
+{
+    std::shared_ptr<session_t> session = find_session(req, res);
+    if (!session)
+        return;
+
+    uint32_t steps = 1;
+    if (const char *value = req.url_params.get("steps")) {
+        const unsigned long long parsed = std::strtoull(value, nullptr, 10);
+        if (parsed == 0 || parsed > MAXIMUM_BATCH_STEPS) {
+            res.code = 400;
+            res.body = "Invalid steps";
+            res.end();
+            return;
+        }
+        steps = (uint32_t)parsed;
+    }
+
+    if (!allow_populations || !req.url_params.get("populations")) {
+        send_frame(req, res, *session->simulation.advance(steps), binary);
+        return;
+    }
+
+    static thread_local std::vector<population_t> populations;
+    populations.clear();
+    std::shared_ptr<const snapshot_t> snapshot = session->simulation.advance(steps, &populations);
+    {
+        scoped_timer_t timer(PHASE_ENCODE);
+        const char *since = req.url_params.get("since");
+        if (since) {
+            uint64_t run, tick;
+            parse_since(since, run, tick);
+            write_snapshot_frame(*snapshot, run, tick, false, res.body);
+        } else {
+            write_keyframe_json(snapshot->grid, snapshot->symbols, snapshot->tick, res.body);
+        }
+        append_populations_json(populations, res.body);
+    }
+    res.set_header("Content-Type", "application/json");
+    res.set_header("X-Ecosim-Run", std::to_string(snapshot->run));
+    res.end();
+}
 
 int main()
 {
-    crow::SimpleApp app;
+    crow::App<metrics_middleware_t> app;
 
     // Endpoint to serve the HTML page
     CROW_ROUTE(app, "/")
@@ -81,382 +363,204 @@ int main()
         .methods("POST"_method)([](crow::request &req, crow::response &res)
                                 { 
         // Parse the JSON request body
-        nlohmann::json request_body = nlohmann::json::parse(req.body);
+        const nlohmann::json request_body = nlohmann::json::parse(req.body, nullptr, false);
+        if (request_body.is_discarded()) {
+        res.code = 400;
+        res.body = "Invalid JSON";
+        res.end();
+        return;
+        }
 
-       // Validate the request body 
-        uint32_t total_entinties = (uint32_t)request_body["plants"] + (uint32_t)request_body["herbivores"] + (uint32_t)request_body["carnivores"];
-        if (total_entinties > NUM_ROWS * NUM_ROWS) {
+        // Runs are reproducible from the seed, a random one is picked when absent
+        static thread_local std::random_device rd;
+        simulation_config_t config;
+        config.seed = (uint64_t)rd() << 32 | rd();
+        config.threads = DEFAULT_SESSION_THREADS;
+        std::string error;
+        if (!parse_run_config(request_body, config, error)) {
         res.code = 400;
-        res.body = "Too many entities";
+        res.body = error;
         res.end();
         return;
         }
 
-        // Clear the entity grid
-        entity_grid.clear();
-        entity_grid.assign(NUM_ROWS, std::vector<entity_t>(NUM_ROWS, { empty, 0, 0}));
-        
-        // Create the entities
-        int i;
-        int row, col;
-        for(i = 0; i < (uint32_t)request_body["plants"]; i++){
-            static std::random_device rd;
-            static std::mt19937 gen(rd());
-            std::uniform_int_distribution<> dis(0, 14);
-            row = dis(gen);
-            col = dis(gen);
-
-            while(!entity_grid[row][col].type == empty){
-                row = dis(gen);
-                col = dis(gen);
-            }
-            
-            entity_grid[row][col].type = plant;
-            entity_grid[row][col].age = 0; 
+        // Without a tick_rate the world advances once per /next-iteration,
+        // with one it runs on its own thread, 0 meaning as fast as possible
+        config.background = request_body.contains("tick_rate");
+        if (config.background) {
+        const nlohmann::json &rate = request_body["tick_rate"];
+        config.tick_rate = rate.is_number() ? rate.get<double>() : -1;
         }
-        for(i = 0; i < (uint32_t)request_body["herbivores"]; i++){
-            static std::random_device rd;
-            static std::mt19937 gen(rd());
-            std::uniform_int_distribution<> dis(0, 14);
-            row = dis(gen);
-            col = dis(gen);
-
-            while(!entity_grid[row][col].type == empty){
-                row = dis(gen);
-                col = dis(gen);
-            }
-            
-            entity_grid[row][col].type = herbivore;
-            entity_grid[row][col].age = 0;
-            entity_grid[row][col].energy = 100; 
+        if (config.tick_rate < 0) {
+        res.code = 400;
+        res.body = "Invalid tick rate";
+        res.end();
+        return;
+        }
+
+        // A new session unless the body names one to restart
+        std::shared_ptr<session_t> session;
+        if (request_body.contains("session")) {
+        const nlohmann::json &id = request_body["session"];
+        session = id.is_string() ? sessions.find(id.get<std::string>()) : nullptr;
+        if (!session) {
+        res.code = 404;
+        res.body = "Unknown session";
+        res.end();
+        return;
         }
-        for(i = 0; i < (uint32_t)request_body["carnivores"]; i++){
-            static std::random_device rd;
-            static std::mt19937 gen(rd());
-            std::uniform_int_distribution<> dis(0, 14);
-            row = dis(gen);
-            col = dis(gen);
-
-            while(!entity_grid[row][col].type == empty){
-                row = dis(gen);
-                col = dis(gen);
-            }
-            
-            entity_grid[row][col].type = carnivore;
-            entity_grid[row][col].age = 0;
-            entity_grid[row][col].energy = 100;
+        } else {
+        session = sessions.create();
+        watch_session(*session);
         }
 
-        // Return the JSON representation of the entity grid
-        nlohmann::json json_grid = entity_grid; 
-        res.body = json_grid.dump();
-        res.end(); });
+        std::shared_ptr<const snapshot_t> snapshot;
+        {
+        std::lock_guard<std::mutex> lock(session->mutex);
+        if (!sessions.reserve(*session, config.width, config.height)) {
+        if (!request_body.contains("session"))
+            sessions.erase(session->id);
+        res.code = 503;
+        res.body = "Simulation memory limit reached";
+        res.end();
+        return;
+        }
+        snapshot = session->simulation.start(config);
+        }
+
+        // Return the representation of the entity grid
+        res.set_header("X-Ecosim-Session", session->id);
+        res.set_header("X-Ecosim-Seed", std::to_string(config.seed));
+        res.set_header("X-Ecosim-Species", snapshot->symbols.substr(1));
+        send_grid(res, *snapshot, wants_binary(req)); });
 
   // Endpoint to process HTTP GET requests for the next simulation iteration
   CROW_ROUTE(app, "/next-iteration")
-      .methods("GET"_method)([]()
+      .methods("GET"_method)([](const crow::request &req, crow::response &res)
+                             {
+    // Simulate the next iterations, unless the simulation runs on its own,
+    // and return the representation of the entity grid
+    advance_and_send(req, res, wants_binary(req), true); });
+
+  // Same as /next-iteration, always answering with a binary frame
+  CROW_ROUTE(app, "/next-iteration.bin")
+      .methods("GET"_method)([](const crow::request &req, crow::response &res)
                              {
-    // Simulate the next iteration
-    // Iterate over the entity grid and simulate the behaviour of each entity
-    // Create a copy of the entity grid to store the updated entities
-    std::vector<std::vector<entity_t>> updated_grid = entity_grid;
-    
-    for (uint32_t i = 0; i < NUM_ROWS; ++i) {
-        for (uint32_t j = 0; j < NUM_ROWS; ++j) {
-            entity_t &current_entity = entity_grid[i][j];
-            entity_t &updated_entity = updated_grid[i][j];
-            
-            // Skip empty cells
-            if (current_entity.type == empty) {
-                continue;
-            }
-            
-            // Update the age
-            updated_entity.age++;
-            
-            // Check if the entity reaches its maximum age
-            if (current_entity.type == plant && current_entity.age >= PLANT_MAXIMUM_AGE) {
-                // Decompose the plant
-                updated_entity.type = empty;
-                updated_entity.energy = 0;
-            }
-            else if (current_entity.type == herbivore && current_entity.age >= HERBIVORE_MAXIMUM_AGE) {
-                // Herbivore reaches its maximum age, dies
-                updated_entity.type = empty;
-                updated_entity.energy = 0;
-            }
-            else if (current_entity.type == carnivore && current_entity.age >= CARNIVORE_MAXIMUM_AGE) {
-                // Carnivore reaches its maximum age, dies
-                updated_entity.type = empty;
-                updated_entity.energy = 0;
-            } else if (current_entity.energy <= 0 && current_entity.type != plant) {
-                updated_entity.type = empty;
-                updated_entity.energy = 0;
-                updated_entity.age = 0;
-            }
-            else {
-                // Implement growth and additional requirements for plants
-                if (current_entity.type == plant) {
-                    if ((rand() / (double)RAND_MAX) < PLANT_REPRODUCTION_PROBABILITY) {
-                        // Calcula as posições das células vizinhas (acima, abaixo, esquerda, direita)
-                        std::vector<pos_t> adjacent_cells = {
-                            {i - 1, j}, // Célula acima
-                            {i + 1, j}, // Célula abaixo
-                            {i, j - 1}, // Célula à esquerda
-                            {i, j + 1}  // Célula à direita
-                        };
-
-                        // Embaralha aleatoriamente as posições das células vizinhas
-                        std::random_shuffle(adjacent_cells.begin(), adjacent_cells.end());
-
-                        for (const pos_t &adjacent_pos : adjacent_cells) {
-                            uint32_t adjacent_i = adjacent_pos.i;
-                            uint32_t adjacent_j = adjacent_pos.j;
-
-                            // Verifica se a célula vizinha está dentro dos limites do grid
-                            if (adjacent_i >= 0 && adjacent_i < NUM_ROWS && adjacent_j >= 0 
-                                && adjacent_j < NUM_ROWS) {
-                                entity_t &target_entity = updated_grid[adjacent_i][adjacent_j];
-
-                                // Verifica se a célula vizinha está vazia (empty)
-                                if (target_entity.type == empty) {
-                                    // Cria uma nova planta na célula vizinha vazia
-                                    target_entity.type = plant;
-                                    target_entity.energy = 0; // A energia da planta pode ser mantida como 0
-                                    target_entity.age = 0;    // A idade da planta é reiniciada
-                                    break; // O crescimento da planta ocorreu com sucesso
-                                }
-                            }
-                        }
-                    }
-                }
-
-                    // Implement movement for herbivores
-                    if (current_entity.type == herbivore) {
-                        if ((rand() / (double)RAND_MAX) < HERBIVORE_MOVE_PROBABILITY) {
-                            // Calcula as posições das células vizinhas (acima, abaixo, esquerda, direita)
-                            std::vector<pos_t> adjacent_cells = {
-                                {i - 1, j}, // Célula acima
-                                {i + 1, j}, // Célula abaixo
-                                {i, j - 1}, // Célula à esquerda
-                                {i, j + 1}  // Célula à direita
-                            };
-
-                            // Embaralha aleatoriamente as posições das células vizinhas
-                            std::random_shuffle(adjacent_cells.begin(), adjacent_cells.end());
-
-                            for (const pos_t &adjacent_pos : adjacent_cells) {
-                                uint32_t adjacent_i = adjacent_pos.i;
-                                uint32_t adjacent_j = adjacent_pos.j;
-
-                                // Verifica se a célula vizinha está dentro dos limites do grid
-                                if (adjacent_i >= 0 && adjacent_i < NUM_ROWS && adjacent_j >= 0 
-                                    && adjacent_j < NUM_ROWS) {
-                                    entity_t &target_entity = updated_grid[adjacent_i][adjacent_j];
-
-                                    // Verifica se a célula vizinha está vazia (empty) e não contém um carnívoro
-                                    if (target_entity.type == empty) {
-                                        // Move o herbívoro para a célula vizinha
-                                        updated_entity.type = empty;
-                                        updated_entity.energy = 0; // Custo de energia pelo movimento
-                                        target_entity.type = herbivore;
-                                        target_entity.energy = current_entity.energy - 5;
-                                        target_entity.age = current_entity.age + 1;
-                                        break; // O herbívoro moveu-se com sucesso
-                                    }
-                                }
-                            }
-                        }
-                    }
-                    
-                    // Example: Implement eating for herbivores
-                    if (current_entity.type == herbivore) {
-                        if ((rand() / (double)RAND_MAX) < HERBIVORE_EAT_PROBABILITY) {
-                            // Calcula as posições das células vizinhas (acima, abaixo, esquerda, direita)
-                            std::vector<pos_t> adjacent_cells = {
-                                {i - 1, j}, // Célula acima
-                                {i + 1, j}, // Célula abaixo
-                                {i, j - 1}, // Célula à esquerda
-                                {i, j + 1}  // Célula à direita
-                            };
-
-                            // Verifica se alguma célula adjacente contém uma planta
-                            for (const pos_t &adjacent_pos : adjacent_cells) {
-                                uint32_t adjacent_i = adjacent_pos.i;
-                                uint32_t adjacent_j = adjacent_pos.j;
-
-                                // Verifica se a célula vizinha está dentro dos limites do grid
-                                if (adjacent_i >= 0 && adjacent_i < NUM_ROWS && adjacent_j >= 0 
-                                    && adjacent_j < NUM_ROWS) {
-                                    entity_t &target_entity = updated_grid[adjacent_i][adjacent_j];
-
-                                    // Verifica se a célula adjacente contém uma planta
-                                    if (target_entity.type == plant) {
-                                        // O herbívoro come a planta
-                                        updated_entity.energy += 30;
-                                        current_entity.energy += 30; // Ganho de energia ao comer uma planta
-                                        target_entity.type = empty; // A planta é removida
-                                        target_entity.energy = 0;   // A célula fica vazia
-                                        break; // O herbívoro comeu com sucesso
-                                    }
-                                }
-                            }
-                        }
-                    }
-                    
-                    // Implement reproduction and energy update for herbivores
-                    if (current_entity.type == herbivore) {
-                        if (current_entity.energy > THRESHOLD_ENERGY_FOR_REPRODUCTION && 
-                            (rand() / (double)RAND_MAX) < HERBIVORE_REPRODUCTION_PROBABILITY) {
-                            // Verifica se a energia do herbívoro é suficiente para reprodução
-                            if (current_entity.energy >= 10) {
-                                // Calcula as posições das células vizinhas (acima, abaixo, esquerda, direita)
-                                std::vector<pos_t> adjacent_cells = {
-                                    {i - 1, j}, // Célula acima
-                                    {i + 1, j}, // Célula abaixo
-                                    {i, j - 1}, // Célula à esquerda
-                                    {i, j + 1}  // Célula à direita
-                                };
-
-                                // Embaralha aleatoriamente as posições das células vizinhas
-                                std::random_shuffle(adjacent_cells.begin(), adjacent_cells.end());
-
-                                for (const pos_t &adjacent_pos : adjacent_cells) {
-                                    uint32_t adjacent_i = adjacent_pos.i;
-                                    uint32_t adjacent_j = adjacent_pos.j;
-
-                                    // Verifica se a célula vizinha está dentro dos limites do grid
-                                    if (adjacent_i >= 0 && adjacent_i < NUM_ROWS && adjacent_j >= 0 
-                                        && adjacent_j < NUM_ROWS) {
-                                        entity_t &target_entity = updated_grid[adjacent_i][adjacent_j];
-
-                                        // Verifica se a célula vizinha está vazia (empty)
-                                        if (target_entity.type == empty) {
-                                            // O herbívoro se reproduz
-                                            updated_entity.energy -= 10;
-                                            current_entity.energy -= 10; // Custo de energia da reprodução
-                                            target_entity.type = herbivore;
-                                            target_entity.energy = 20;  // Energia inicial da prole
-                                            target_entity.age = 0;      // Idade da prole começa em 0
-                                            break; // A reprodução do herbívoro ocorreu com sucesso
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-
-                // Implement movement for carnivores
-                if (current_entity.type == carnivore) {
-                    if ((rand() / (double)RAND_MAX) < CARNIVORE_MOVE_PROBABILITY) {
-                        // Calcula as posições das células vizinhas (acima, abaixo, esquerda, direita)
-                        std::vector<pos_t> adjacent_cells = {
-                            {i - 1, j}, // Célula acima
-                            {i + 1, j}, // Célula abaixo
-                            {i, j - 1}, // Célula à esquerda
-                            {i, j + 1}  // Célula à direita
-                        };
-
-                        // Embaralha aleatoriamente as posições das células vizinhas
-                        std::random_shuffle(adjacent_cells.begin(), adjacent_cells.end());
-
-                        for (const pos_t &adjacent_pos : adjacent_cells) {
-                            uint32_t adjacent_i = adjacent_pos.i;
-                            uint32_t adjacent_j = adjacent_pos.j;
-
-                            // Verifica se a célula vizinha está dentro dos limites do grid
-                            if (adjacent_i >= 0 && adjacent_i < NUM_ROWS && adjacent_j >= 0 && adjacent_j < NUM_ROWS) {
-                                entity_t &target_entity = updated_grid[adjacent_i][adjacent_j];
-
-                                // Move o carnívoro para a célula vizinha
-                                updated_entity.type = empty;
-                                updated_entity.energy = 0; // Custo de energia pelo movimento
-                                target_entity.type = carnivore;
-                                target_entity.energy = current_entity.energy - 5;
-                                target_entity.age = current_entity.age + 1;
-                                break; // O carnívoro moveu-se com sucesso
-                            }
-                        }
-                    }
-                }
-
-                // Implement eating for carnivores
-                if (current_entity.type == carnivore) {
-                    // Verifica se alguma célula adjacente contém um herbívoro
-                    for (int dx = -1; dx <= 1; dx++) {
-                        for (int dy = -1; dy <= 1; dy++) {
-                            uint32_t adjacent_i = i + dx;
-                            uint32_t adjacent_j = j + dy;
-
-                            // Verifica se a célula vizinha está dentro dos limites do grid
-                            if (adjacent_i >= 0 && adjacent_i < NUM_ROWS && adjacent_j >= 0 
-                                && adjacent_j < NUM_ROWS) {
-                                entity_t &target_entity = updated_grid[adjacent_i][adjacent_j];
-
-                                // Verifica se a célula adjacente contém um herbívoro
-                                if (target_entity.type == herbivore) {
-                                    // O carnívoro come o herbívoro
-                                    updated_entity.energy += 20;
-                                    current_entity.energy += 20; // Ganho de energia ao comer um herbívoro
-                                    target_entity.type = empty;  // O herbívoro é removido
-                                    target_entity.energy = 0;    // A célula fica vazia
-                                }
-                            }
-                        }
-                    }
-                }
-
-                // Implement reproduction and energy update for carnivores
-                if (current_entity.type == carnivore) {
-                    if (current_entity.energy > THRESHOLD_ENERGY_FOR_REPRODUCTION && 
-                        (rand() / (double)RAND_MAX) < CARNIVORE_REPRODUCTION_PROBABILITY) {
-                        // Verifica se a energia do carnívoro é suficiente para reprodução
-                        if (current_entity.energy >= 10) {
-                            // Calcula as posições das células vizinhas (acima, abaixo, esquerda, direita)
-                            std::vector<pos_t> adjacent_cells = {
-                                {i - 1, j}, // Célula acima
-                                {i + 1, j}, // Célula abaixo
-                                {i, j - 1}, // Célula à esquerda
-                                {i, j + 1}  // Célula à direita
-                            };
-
-                            // Embaralha aleatoriamente as posições das células vizinhas
-                            std::random_shuffle(adjacent_cells.begin(), adjacent_cells.end());
-
-                            for (const pos_t &adjacent_pos : adjacent_cells) {
-                                uint32_t adjacent_i = adjacent_pos.i;
-                                uint32_t adjacent_j = adjacent_pos.j;
-
-                                // Verifica se a célula vizinha está dentro dos limites do grid
-                                if (adjacent_i >= 0 && adjacent_i < NUM_ROWS && adjacent_j >= 0 && adjacent_j < NUM_ROWS) {
-                                    entity_t &target_entity = updated_grid[adjacent_i][adjacent_j];
-
-                                    // Verifica se a célula vizinha está vazia (empty)
-                                    if (target_entity.type == empty) {
-                                        // O carnívoro se reproduz
-                                        updated_entity.energy -= 10;
-                                        current_entity.energy -= 10; // Custo de energia da reprodução
-                                        target_entity.type = carnivore;
-                                        target_entity.energy = 20;  // Energia inicial da prole
-                                        target_entity.age = 0;      // Idade da prole começa em 0
-                                        break; // A reprodução do carnívoro ocorreu com sucesso
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-            }
+    advance_and_send(req, res, true, false); });
+
+  // Pushes a binary frame whenever a tick is published. The client's first
+  // message is the session id, every later one acknowledges a frame. Until
+  // then newer ticks are folded into the next delta instead of being queued.
+  CROW_ROUTE(app, "/stream")
+      .websocket()
+      .onopen([](crow::websocket::connection &conn)
+              { conn.userdata(nullptr); })
+      .onmessage([](crow::websocket::connection &conn, const std::string &data, bool)
+                 {
+    if (conn.userdata()) {
+        // Streaming keeps the session from being evicted
+        static_cast<session_t *>(conn.userdata())->touch();
+        stream_hub.acknowledge(&conn);
+        return;
+    }
+    std::shared_ptr<session_t> session = sessions.find(data);
+    if (!session) {
+        conn.close("Unknown session");
+        return;
+    }
+    // The hub holds the session for as long as the client is subscribed
+    conn.userdata(session.get());
+    stream_hub.subscribe(&conn, std::shared_ptr<simulation_t>(session, &session->simulation),
+                         [&conn](const std::string &frame)
+                         { conn.send_binary(frame); }); })
+      .onclose([](crow::websocket::connection &conn, const std::string &)
+               { stream_hub.unsubscribe(&conn); });
+
+    // Saves the session to disk, from its last published state so the run
+    // goes on meanwhile. Answers with the tick saved and the file size.
+    CROW_ROUTE(app, "/checkpoint")
+        .methods("POST"_method)([](const crow::request &req, crow::response &res)
+                                {
+        std::shared_ptr<session_t> session = find_session(req, res);
+        if (!session)
+            return;
+        std::shared_ptr<const snapshot_t> snapshot = session->simulation.snapshot();
+        if (!snapshot->config) {
+            res.code = 409;
+            res.body = "Simulation not started";
+            res.end();
+            return;
         }
-        
-        // Update the entity grid with the updated entities
-        entity_grid = updated_grid;
-        
-        // Return the JSON representation of the entity grid
-        nlohmann::json json_grid = entity_grid; 
-        return json_grid.dump(); });
-    app.port(8080).run();
+        std::string error;
+        const size_t bytes = save_session(*session, *snapshot, error);
+        if (session->evicted)
+            forget_checkpoint(session->id);
+        if (!bytes) {
+            res.code = 500;
+            res.body = error;
+            res.end();
+            return;
+        }
+        res.set_header("Content-Type", "application/json");
+        res.body = nlohmann::json{{"session", session->id}, {"tick", snapshot->tick}, {"bytes", bytes}}.dump();
+        res.end(); });
 
+    // Resumes the session saved under ?session=<id>, replacing the live one
+    // with that id if any, and answers like /start-simulation
+    CROW_ROUTE(app, "/restore")
+        .methods("POST"_method)([](const crow::request &req, crow::response &res)
+                                {
+        const char *param = req.url_params.get("session");
+        const std::string id = param ? std::string(param) : req.get_header_value("X-Ecosim-Session");
+        if (!valid_session_id(id)) {
+            res.code = 400;
+            res.body = "Invalid session";
+            res.end();
+            return;
+        }
+        int code = 0;
+        std::string error;
+        std::shared_ptr<const snapshot_t> snapshot = restore_session(id, code, error);
+        if (!snapshot) {
+            res.code = code;
+            res.body = code == 404 ? "No checkpoint" : error;
+            res.end();
+            return;
+        }
+        res.set_header("X-Ecosim-Session", id);
+        res.set_header("X-Ecosim-Seed", std::to_string(snapshot->seed));
+        res.set_header("X-Ecosim-Species", snapshot->symbols.substr(1));
+        send_grid(res, *snapshot, wants_binary(req)); });
+
+    // Phase timings, request counts and session populations in Prometheus text format
+    CROW_ROUTE(app, "/metrics")
+    ([](const crow::request &, crow::response &res)
+     {
+        std::string out;
+        write_phase_metrics(out);
+        request_metrics.write_prometheus(out);
+        write_session_metrics(out);
+        res.set_header("Content-Type", "text/plain; version=0.0.4");
+        res.body = std::move(out);
+        res.end(); });
+
+    // Sessions saved before the last shutdown come back under their old ids
+    restore_sessions();
+    std::thread checkpointer;
+    if (const char *interval = std::getenv("ECOSIM_CHECKPOINT_INTERVAL"))
+        if (const long seconds = std::strtol(interval, nullptr, 10); seconds > 0)
+            checkpointer = std::thread(run_checkpointer, std::chrono::seconds(seconds));
+
+    // Handlers share no mutable state outside the sessions, so requests run on all cores
+    app.port(8080).multithreaded().run();
+
+    if (checkpointer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(checkpointer_mutex);
+            checkpointer_stopping = true;
+        }
+        checkpointer_wake.notify_all();
+        checkpointer.join();
+    }
     return 0;
 }
\ No newline at end of file
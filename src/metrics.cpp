@@ -0,0 +1,105 @@
+#include "metrics.hpp"
+
+#include <cstdio>
+
+namespace
+{
+    const char *const PHASE_NAMES[PHASE_COUNT] = {"age", "feeding", "movement", "apply", "copy_forward",
+                                                  "step", "publish", "placement", "encode", "checkpoint"};
+
+    duration_histogram_t phases[PHASE_COUNT];
+
+    void append_number(std::string &out, double value)
+    {
+        char text[32];
+        std::snprintf(text, sizeof(text), "%.9g", value);
+        out += text;
+    }
+}
+
+void duration_histogram_t::record(std::chrono::steady_clock::duration elapsed)
+{
+    const double seconds = std::chrono::duration<double>(elapsed).count();
+    size_t bucket = 0;
+    while (bucket < DURATION_BUCKET_COUNT && seconds > DURATION_BUCKETS[bucket])
+        ++bucket;
+    counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+    total_ns_.fetch_add((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+                        std::memory_order_relaxed);
+}
+
+void duration_histogram_t::write_prometheus(const char *name, const std::string &labels, std::string &out) const
+{
+    const std::string prefix = labels.empty() ? "" : labels + ",";
+    uint64_t cumulative = 0;
+    for (size_t bucket = 0; bucket <= DURATION_BUCKET_COUNT; ++bucket)
+    {
+        cumulative += counts_[bucket].load(std::memory_order_relaxed);
+        out += name;
+        out += "_bucket{" + prefix + "le=\"";
+        if (bucket < DURATION_BUCKET_COUNT)
+            append_number(out, DURATION_BUCKETS[bucket]);
+        else
+            out += "+Inf";
+        out += "\"} " + std::to_string(cumulative) + "\n";
+    }
+
+    const std::string braces = labels.empty() ? "" : "{" + labels + "}";
+    out += name;
+    out += "_sum" + braces + " ";
+    append_number(out, total_ns_.load(std::memory_order_relaxed) * 1e-9);
+    out += "\n";
+    out += name;
+    out += "_count" + braces + " " + std::to_string(cumulative) + "\n";
+}
+
+duration_histogram_t &phase_histogram(phase_t phase)
+{
+    return phases[phase];
+}
+
+void write_phase_metrics(std::string &out)
+{
+    out += "# HELP ecosim_phase_seconds Time spent in each phase of a tick or request.\n"
+           "# TYPE ecosim_phase_seconds histogram\n";
+    for (unsigned phase = 0; phase < PHASE_COUNT; ++phase)
+        phases[phase].write_prometheus("ecosim_phase_seconds", std::string("phase=\"") + PHASE_NAMES[phase] + "\"",
+                                       out);
+}
+
+void request_metrics_t::record(const std::string &endpoint, int code, std::chrono::steady_clock::duration elapsed)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++counts_[{endpoint, code}];
+    durations_[endpoint].record(elapsed);
+}
+
+void request_metrics_t::write_prometheus(std::string &out) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    out += "# HELP ecosim_requests_total HTTP requests answered, by endpoint and status code.\n"
+           "# TYPE ecosim_requests_total counter\n";
+    for (const auto &entry : counts_)
+        out += "ecosim_requests_total{endpoint=\"" + entry.first.first + "\",code=\"" +
+               std::to_string(entry.first.second) + "\"} " + std::to_string(entry.second) + "\n";
+
+    out += "# HELP ecosim_request_seconds Time from receiving a request to its answer, by endpoint.\n"
+           "# TYPE ecosim_request_seconds histogram\n";
+    for (const auto &entry : durations_)
+        entry.second.write_prometheus("ecosim_request_seconds", "endpoint=\"" + entry.first + "\"", out);
+}
+
+std::string prometheus_label(const std::string &value)
+{
+    std::string escaped;
+    for (char c : value)
+    {
+        if (c == '\\' || c == '"')
+            escaped += '\\';
+        if (c == '\n')
+            escaped += "\\n";
+        else
+            escaped += c;
+    }
+    return escaped;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+// Upper bounds of the duration histogram buckets, in seconds, from 10 us to 10 s
+const double DURATION_BUCKETS[] = {1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4, 1e-3, 2.5e-3, 5e-3, 1e-2,
+                                   2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+const size_t DURATION_BUCKET_COUNT = sizeof(DURATION_BUCKETS) / sizeof(DURATION_BUCKETS[0]);
+
+// Histogram of durations with fixed buckets. Recording is a few relaxed
+// atomic increments, so any number of threads can share one without locks.
+class duration_histogram_t
+{
+public:
+    void record(std::chrono::steady_clock::duration elapsed);
+
+    // Appends the _bucket, _sum and _count lines of a Prometheus histogram,
+    // labels being the label list without braces, possibly empty
+    void write_prometheus(const char *name, const std::string &labels, std::string &out) const;
+
+private:
+    std::atomic<uint64_t> counts_[DURATION_BUCKET_COUNT + 1] = {}; // Last one past every bound
+    std::atomic<uint64_t> total_ns_{0};
+};
+
+// Timed steps of a tick and of the requests that drive it
+enum phase_t : unsigned
+{
+    PHASE_AGE,
+    PHASE_FEEDING,
+    PHASE_MOVEMENT,
+    PHASE_APPLY,
+    PHASE_COPY_FORWARD,
+    PHASE_STEP,       // A whole tick
+    PHASE_PUBLISH,    // Copying the grid into a snapshot for readers
+    PHASE_PLACEMENT,  // Setting up a new run
+    PHASE_ENCODE,     // Writing a response frame
+    PHASE_CHECKPOINT, // Saving a session to disk
+    PHASE_COUNT
+};
+
+duration_histogram_t &phase_histogram(phase_t phase);
+
+// Records the time from its construction to the end of its scope
+class scoped_timer_t
+{
+public:
+    explicit scoped_timer_t(phase_t phase) : phase_(phase), start_(std::chrono::steady_clock::now()) {}
+    ~scoped_timer_t() { phase_histogram(phase_).record(std::chrono::steady_clock::now() - start_); }
+
+    scoped_timer_t(const scoped_timer_t &) = delete;
+    scoped_timer_t &operator=(const scoped_timer_t &) = delete;
+
+private:
+    const phase_t phase_;
+    const std::chrono::steady_clock::time_point start_;
+};
+
+// Requests served, counted by endpoint and status code, with the time each
+// endpoint took to answer
+class request_metrics_t
+{
+public:
+    void record(const std::string &endpoint, int code, std::chrono::steady_clock::duration elapsed);
+    void write_prometheus(std::string &out) const;
+
+private:
+    mutable std::mutex mutex_;
+    std::map<std::pair<std::string, int>, uint64_t> counts_;
+    std::map<std::string, duration_histogram_t> durations_;
+};
+
+// Phase histograms in Prometheus text format
+void write_phase_metrics(std::string &out);
+
+// Escapes a label value for the Prometheus text format
+std::string prometheus_label(const std::string &value);
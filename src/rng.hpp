@@ -0,0 +1,43 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// Philox4x32-10 counter-based generator (Salmon et al., "Parallel random
+// numbers: as easy as 1, 2, 3"). Each output block is a pure function of a
+// 128-bit counter and a 64-bit key, so any thread can compute any draw
+// without shared state.
+inline std::array<uint32_t, 4> philox4x32(std::array<uint32_t, 4> ctr, std::array<uint32_t, 2> key)
+{
+    const uint32_t M0 = 0xD2511F53u;
+    const uint32_t M1 = 0xCD9E8D57u;
+    const uint32_t W0 = 0x9E3779B9u;
+    const uint32_t W1 = 0xBB67AE85u;
+
+    for (int round = 0; round < 10; ++round)
+    {
+        const uint64_t p0 = (uint64_t)M0 * ctr[0];
+        const uint64_t p1 = (uint64_t)M1 * ctr[2];
+        ctr = {(uint32_t)(p1 >> 32) ^ ctr[1] ^ key[0], (uint32_t)p1,
+               (uint32_t)(p0 >> 32) ^ ctr[3] ^ key[1], (uint32_t)p0};
+        key[0] += W0;
+        key[1] += W1;
+    }
+    return ctr;
+}
+
+// Random draws keyed by (seed, tick, cell, action): the same tuple always
+// yields the same four 32-bit words
+struct counter_rng_t
+{
+    uint64_t seed = 0;
+
+    std::array<uint32_t, 4> draw(uint64_t tick, uint32_t cell, uint32_t action) const
+    {
+        return philox4x32({cell, action, (uint32_t)tick, (uint32_t)(tick >> 32)},
+                          {(uint32_t)seed, (uint32_t)(seed >> 32)});
+    }
+
+    // Uniform double in [0, 1)
+    static double unit(uint32_t word) { return word * 0x1.0p-32; }
+};
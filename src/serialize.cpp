@@ -0,0 +1,217 @@
+#include "serialize.hpp"
+
+#include <charconv>
+#include <cstring>
+
+namespace
+{
+    // Longest cell: {"age":-32768,"energy":-32768,"type":"X"} plus a separator
+    const size_t MAXIMUM_CELL_BYTES = 42;
+
+    inline char *append(char *out, const char *text, size_t length)
+    {
+        std::memcpy(out, text, length);
+        return out + length;
+    }
+
+    template <size_t N>
+    inline char *append(char *out, const char (&text)[N])
+    {
+        return append(out, text, N - 1);
+    }
+
+    inline char *append(char *out, int16_t value)
+    {
+        return std::to_chars(out, out + 6, value).ptr;
+    }
+
+    inline char *append(char *out, uint64_t value)
+    {
+        return std::to_chars(out, out + 20, value).ptr;
+    }
+
+    template <typename T>
+    inline char *append_le(char *out, T value)
+    {
+        for (size_t b = 0; b < sizeof(T); ++b)
+            *out++ = (char)((uint64_t)value >> (8 * b));
+        return out;
+    }
+
+    inline char *append_plane(char *out, const std::vector<int16_t> &plane)
+    {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        std::memcpy(out, plane.data(), plane.size() * sizeof(int16_t));
+        return out + plane.size() * sizeof(int16_t);
+#else
+        for (int16_t value : plane)
+            out = append_le(out, (uint16_t)value);
+        return out;
+#endif
+    }
+
+    inline size_t grid_json_bytes(const grid_t &grid)
+    {
+        return grid.size() * MAXIMUM_CELL_BYTES + (size_t)grid.height * 3 + 2;
+    }
+
+    char *append_grid_json(char *p, const grid_t &grid, const std::string &symbols)
+    {
+        *p++ = '[';
+        for (uint32_t i = 0; i < grid.height; ++i)
+        {
+            if (i > 0)
+                *p++ = ',';
+            *p++ = '[';
+            for (uint32_t j = 0; j < grid.width; ++j)
+            {
+                const size_t idx = grid.index(i, j);
+                if (j > 0)
+                    *p++ = ',';
+                p = append(p, "{\"age\":");
+                p = append(p, grid.age[idx]);
+                p = append(p, ",\"energy\":");
+                p = append(p, grid.energy[idx]);
+                p = append(p, ",\"type\":\"");
+                *p++ = entity_symbol(grid.type[idx], symbols);
+                p = append(p, "\"}");
+            }
+            *p++ = ']';
+        }
+        *p++ = ']';
+        return p;
+    }
+
+    // Prefix shared by the keyframe and delta JSON objects
+    char *append_json_prologue(char *p, const grid_t &grid, uint64_t tick, bool keyframe)
+    {
+        p = append(p, "{\"tick\":");
+        p = append(p, tick);
+        p = keyframe ? append(p, ",\"keyframe\":true") : append(p, ",\"keyframe\":false");
+        p = append(p, ",\"width\":");
+        p = append(p, (uint64_t)grid.width);
+        p = append(p, ",\"height\":");
+        p = append(p, (uint64_t)grid.height);
+        return p;
+    }
+
+    // Longest prologue and base field, with 20-digit numbers
+    const size_t MAXIMUM_PROLOGUE_BYTES = 128;
+
+    char *append_frame_header(char *p, const grid_t &grid, uint64_t tick, uint16_t flags)
+    {
+        p = append(p, FRAME_MAGIC, sizeof(FRAME_MAGIC));
+        p = append_le(p, FRAME_VERSION);
+        p = append_le(p, flags);
+        p = append_le(p, grid.width);
+        p = append_le(p, grid.height);
+        return append_le(p, tick);
+    }
+}
+
+void write_grid_json(const grid_t &grid, const std::string &symbols, std::string &out)
+{
+    // Size the buffer for the worst case once and trim it at the end
+    out.resize(grid_json_bytes(grid));
+    char *p = append_grid_json(&out[0], grid, symbols);
+    out.resize(p - out.data());
+}
+
+void write_keyframe_json(const grid_t &grid, const std::string &symbols, uint64_t tick, std::string &out)
+{
+    out.resize(MAXIMUM_PROLOGUE_BYTES + grid_json_bytes(grid));
+    char *p = append_json_prologue(&out[0], grid, tick, true);
+    p = append(p, ",\"grid\":");
+    p = append_grid_json(p, grid, symbols);
+    *p++ = '}';
+    out.resize(p - out.data());
+}
+
+void write_delta_json(const grid_t &grid, const std::string &symbols, uint64_t base_tick, uint64_t tick,
+                      const std::vector<uint32_t> &cells, std::string &out)
+{
+    // Longest cell: [4294967295,"X",-32768,-32768] plus a separator
+    out.resize(MAXIMUM_PROLOGUE_BYTES + cells.size() * 33 + 16);
+    char *p = append_json_prologue(&out[0], grid, tick, false);
+    p = append(p, ",\"base\":");
+    p = append(p, base_tick);
+    p = append(p, ",\"cells\":[");
+    for (size_t k = 0; k < cells.size(); ++k)
+    {
+        const uint32_t idx = cells[k];
+        if (k > 0)
+            *p++ = ',';
+        *p++ = '[';
+        p = append(p, (uint64_t)idx);
+        p = append(p, ",\"");
+        *p++ = entity_symbol(grid.type[idx], symbols);
+        p = append(p, "\",");
+        p = append(p, grid.energy[idx]);
+        *p++ = ',';
+        p = append(p, grid.age[idx]);
+        *p++ = ']';
+    }
+    p = append(p, "]}");
+    out.resize(p - out.data());
+}
+
+void write_grid_binary(const grid_t &grid, uint64_t tick, std::string &out)
+{
+    const size_t cells = grid.size();
+    const size_t padding = cells & 1;
+    out.resize(FRAME_HEADER_BYTES + cells + padding + 2 * cells * sizeof(int16_t));
+
+    char *p = append_frame_header(&out[0], grid, tick, 0);
+    p = append(p, (const char *)grid.type.data(), cells);
+    if (padding)
+        *p++ = 0;
+    p = append_plane(p, grid.energy);
+    append_plane(p, grid.age);
+}
+
+void write_delta_binary(const grid_t &grid, uint64_t base_tick, uint64_t tick, const std::vector<uint32_t> &cells,
+                        std::string &out)
+{
+    const size_t count = cells.size();
+    const size_t padding = count & 1;
+    out.resize(DELTA_HEADER_BYTES + count * sizeof(uint32_t) + count + padding + 2 * count * sizeof(int16_t));
+
+    char *p = append_frame_header(&out[0], grid, tick, FRAME_FLAG_DELTA);
+    p = append_le(p, base_tick);
+    p = append_le(p, (uint32_t)count);
+    p = append_le(p, (uint32_t)0);
+    for (uint32_t idx : cells)
+        p = append_le(p, idx);
+    for (uint32_t idx : cells)
+        *p++ = (char)grid.type[idx];
+    if (padding)
+        *p++ = 0;
+    for (uint32_t idx : cells)
+        p = append_le(p, (uint16_t)grid.energy[idx]);
+    for (uint32_t idx : cells)
+        p = append_le(p, (uint16_t)grid.age[idx]);
+}
+
+void append_populations_json(const std::vector<population_t> &populations, std::string &out)
+{
+    // Longest entry: 10 digits and a comma per species, brackets and a separator
+    const size_t species = populations.empty() ? 0 : populations.front().size() - 1;
+    const size_t start = out.size() - 1; // Drops the closing brace
+    out.resize(start + populations.size() * (species * 11 + 3) + 32);
+    char *p = append(&out[start], ",\"populations\":[");
+    for (size_t k = 0; k < populations.size(); ++k)
+    {
+        if (k > 0)
+            *p++ = ',';
+        *p++ = '[';
+        for (size_t type = 1; type <= species; ++type)
+        {
+            if (type > 1)
+                *p++ = ',';
+            p = append(p, (uint64_t)populations[k][type]);
+        }
+        *p++ = ']';
+    }
+    p = append(p, "]}");
+    out.resize(p - out.data());
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "grid.hpp"
+
+#include <string>
+
+// Character used for each entity type in JSON, from the run's table of
+// symbols indexed by type (see species_table_t::symbols)
+inline char entity_symbol(uint8_t type, const std::string &symbols)
+{
+    return type < symbols.size() ? symbols[type] : '?';
+}
+
+// Writes the grid as a JSON array of rows of {"age","energy","type"} objects,
+// byte-for-byte identical to dumping the equivalent nlohmann::json tree
+void write_grid_json(const grid_t &grid, const std::string &symbols, std::string &out);
+
+inline std::string grid_to_json(const grid_t &grid, const std::string &symbols)
+{
+    std::string out;
+    write_grid_json(grid, symbols, out);
+    return out;
+}
+
+// Binary frame layout, all integers little-endian:
+//
+//   offset  size  field
+//   0       4     magic "ECOS"
+//   4       2     format version (FRAME_VERSION)
+//   6       2     flags (FRAME_FLAG_DELTA for delta frames)
+//   8       4     width
+//   12      4     height
+//   16      8     tick
+//   24      n     type plane, one byte per cell in row-major order
+//   24+n    p     zero padding to an even offset
+//   ...     2n    energy plane, int16 per cell
+//   ...     2n    age plane, int16 per cell
+const char FRAME_MAGIC[4] = {'E', 'C', 'O', 'S'};
+const uint16_t FRAME_VERSION = 1;
+const size_t FRAME_HEADER_BYTES = 24;
+const char FRAME_CONTENT_TYPE[] = "application/octet-stream";
+
+void write_grid_binary(const grid_t &grid, uint64_t tick, std::string &out);
+
+inline std::string grid_to_binary(const grid_t &grid, uint64_t tick)
+{
+    std::string out;
+    write_grid_binary(grid, tick, out);
+    return out;
+}
+
+// Delta frames share the header, with FRAME_FLAG_DELTA set, and list only
+// the cells that changed since a base tick:
+//
+//   offset  size  field
+//   24      8     base tick
+//   32      4     number of changed cells n
+//   36      4     reserved, 0
+//   40      4n    cell indices, uint32 in increasing order
+//   40+4n   n     types
+//   ...     p     zero padding to an even offset
+//   ...     2n    energies, int16
+//   ...     2n    ages, int16
+const uint16_t FRAME_FLAG_DELTA = 1;
+const size_t DELTA_HEADER_BYTES = 40;
+
+// Bytes per cell in full and delta frames, used to pick the smaller one
+const size_t FRAME_CELL_BYTES = 5;
+const size_t DELTA_CELL_BYTES = 9;
+
+void write_delta_binary(const grid_t &grid, uint64_t base_tick, uint64_t tick, const std::vector<uint32_t> &cells,
+                        std::string &out);
+
+// JSON counterparts used when a client asks for deltas without accepting
+// binary frames:
+//   {"tick":T,"keyframe":true,"width":W,"height":H,"grid":[...]}
+//   {"tick":T,"keyframe":false,"base":B,"width":W,"height":H,"cells":[[index,"type",energy,age],...]}
+void write_keyframe_json(const grid_t &grid, const std::string &symbols, uint64_t tick, std::string &out);
+void write_delta_json(const grid_t &grid, const std::string &symbols, uint64_t base_tick, uint64_t tick,
+                      const std::vector<uint32_t> &cells, std::string &out);
+
+// Adds "populations":[[plants,herbivores,carnivores],...] to a JSON object
+// written by the functions above, one entry per tick in order and one count
+// per species in table order
+void append_populations_json(const std::vector<population_t> &populations, std::string &out);
@@ -0,0 +1,173 @@
+#include "session.hpp"
+
+#include <random>
+
+namespace
+{
+    // 128 random bits in hexadecimal
+    std::string random_session_id()
+    {
+        static thread_local std::random_device device;
+        static const char DIGITS[] = "0123456789abcdef";
+        std::string id(32, '0');
+        for (size_t k = 0; k < id.size(); k += 8)
+        {
+            uint32_t word = device();
+            for (size_t d = 0; d < 8; ++d, word >>= 4)
+                id[k + d] = DIGITS[word & 15];
+        }
+        return id;
+    }
+}
+
+session_registry_t::session_registry_t(size_t memory_limit, std::chrono::seconds idle_timeout,
+                                       std::function<void(const std::string &)> on_evict)
+    : memory_limit_(memory_limit), idle_timeout_(idle_timeout), on_evict_(std::move(on_evict)),
+      janitor_(&session_registry_t::run, this)
+{
+}
+
+session_registry_t::~session_registry_t()
+{
+    {
+        std::lock_guard<std::mutex> lock(janitor_mutex_);
+        stopping_ = true;
+    }
+    janitor_wake_.notify_all();
+    janitor_.join();
+}
+
+std::shared_ptr<session_t> session_registry_t::create()
+{
+    for (;;)
+    {
+        std::string id = random_session_id();
+        shard_t &part = shard(id);
+        std::lock_guard<std::mutex> lock(part.mutex);
+        std::shared_ptr<session_t> &slot = part.sessions[id];
+        if (slot)
+            continue;
+        slot = std::make_shared<session_t>(id, memory_);
+        return slot;
+    }
+}
+
+std::shared_ptr<session_t> session_registry_t::find_or_create(const std::string &id, bool &created)
+{
+    shard_t &part = shard(id);
+    std::lock_guard<std::mutex> lock(part.mutex);
+    std::shared_ptr<session_t> &slot = part.sessions[id];
+    created = !slot;
+    if (created)
+        slot = std::make_shared<session_t>(id, memory_);
+    else
+        slot->touch();
+    return slot;
+}
+
+std::shared_ptr<session_t> session_registry_t::find(const std::string &id)
+{
+    shard_t &part = shard(id);
+    std::lock_guard<std::mutex> lock(part.mutex);
+    auto it = part.sessions.find(id);
+    if (it == part.sessions.end())
+        return nullptr;
+    it->second->touch();
+    return it->second;
+}
+
+void session_registry_t::erase(const std::string &id)
+{
+    std::shared_ptr<session_t> session;
+    shard_t &part = shard(id);
+    std::lock_guard<std::mutex> lock(part.mutex);
+    auto it = part.sessions.find(id);
+    if (it != part.sessions.end())
+    {
+        session = std::move(it->second);
+        part.sessions.erase(it);
+    }
+}
+
+bool session_registry_t::reserve(session_t &session, uint32_t width, uint32_t height)
+{
+    const size_t bytes = (size_t)width * height * SESSION_BYTES_PER_CELL;
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        size_t total = memory_;
+        while (total - session.bytes + bytes <= memory_limit_)
+        {
+            if (memory_.compare_exchange_weak(total, total - session.bytes + bytes))
+            {
+                session.bytes = bytes;
+                return true;
+            }
+        }
+        if (attempt == 0)
+            evict_idle();
+    }
+    return false;
+}
+
+size_t session_registry_t::size() const
+{
+    size_t count = 0;
+    for (const shard_t &part : shards_)
+    {
+        std::lock_guard<std::mutex> lock(part.mutex);
+        count += part.sessions.size();
+    }
+    return count;
+}
+
+std::vector<std::shared_ptr<session_t>> session_registry_t::list() const
+{
+    std::vector<std::shared_ptr<session_t>> sessions;
+    for (const shard_t &part : shards_)
+    {
+        std::lock_guard<std::mutex> lock(part.mutex);
+        for (const auto &entry : part.sessions)
+            sessions.push_back(entry.second);
+    }
+    return sessions;
+}
+
+void session_registry_t::evict_idle()
+{
+    const int64_t deadline =
+        (std::chrono::steady_clock::now() - idle_timeout_).time_since_epoch().count();
+
+    // Sessions are destroyed outside the shard locks, since that joins their threads
+    std::vector<std::shared_ptr<session_t>> evicted;
+    for (shard_t &part : shards_)
+    {
+        std::lock_guard<std::mutex> lock(part.mutex);
+        for (auto it = part.sessions.begin(); it != part.sessions.end();)
+        {
+            if (it->second->last_access < deadline)
+            {
+                it->second->evicted = true;
+                evicted.push_back(std::move(it->second));
+                it = part.sessions.erase(it);
+            }
+            else
+                ++it;
+        }
+    }
+    if (on_evict_)
+        for (const std::shared_ptr<session_t> &session : evicted)
+            on_evict_(session->id);
+}
+
+void session_registry_t::run()
+{
+    const std::chrono::seconds interval = std::max(idle_timeout_ / 4, std::chrono::seconds(1));
+    std::unique_lock<std::mutex> lock(janitor_mutex_);
+    while (!janitor_wake_.wait_for(lock, interval, [this]
+                                   { return stopping_; }))
+    {
+        lock.unlock();
+        evict_idle();
+        lock.lock();
+    }
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "simulation.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Number of independently locked parts of the session table
+const size_t SESSION_SHARDS = 16;
+
+// Bytes of one cell in a grid or snapshot: type, energy and age
+const size_t GRID_CELL_BYTES = 5;
+static_assert(GRID_CELL_BYTES == sizeof(decltype(grid_t::type)::value_type) +
+                                     sizeof(decltype(grid_t::energy)::value_type) +
+                                     sizeof(decltype(grid_t::age)::value_type),
+              "GRID_CELL_BYTES must follow the grid planes");
+
+// Upper bound of the memory a simulation uses per cell, by part. The change
+// lists hold uint32 cell indices; the change log and the snapshot history
+// drop old ticks past one grid of cells, but keep the latest tick beyond that.
+const size_t SESSION_BYTES_PER_CELL =
+    2 * GRID_CELL_BYTES +                        // Current and next grid
+    5 +                                          // Intent planes
+    (MAXIMUM_SPECIES + 1 + 7) / 8 +              // Bitboards
+    3 * sizeof(uint32_t) +                       // Dirty and vacated lists
+    2 * sizeof(uint32_t) +                       // Change log
+    2 * sizeof(uint32_t) +                       // Snapshot history
+    1 +                                          // Pending changes bitmap
+    (SNAPSHOT_SPARES + 2) * GRID_CELL_BYTES;     // Published, spare and held snapshots
+
+// One independent simulation and its bookkeeping
+struct session_t
+{
+    session_t(std::string id, std::atomic<size_t> &memory) : id(std::move(id)), memory_(memory) { touch(); }
+    ~session_t() { memory_ -= bytes; }
+
+    void touch() { last_access = std::chrono::steady_clock::now().time_since_epoch().count(); }
+
+    const std::string id;
+    std::atomic<int64_t> last_access{0}; // Declared first, the runner touches it until the simulation stops
+    simulation_t simulation;
+
+    std::mutex mutex; // Serializes restarts
+    std::atomic<bool> evicted{false}; // Dropped from the registry for being idle
+    size_t bytes = 0; // Memory reserved for the current grid
+
+private:
+    std::atomic<size_t> &memory_;
+};
+
+// Table of live sessions keyed by an unguessable id. Sessions are spread over
+// shards, each with its own lock held only for the lookup, so requests for
+// different sessions never wait on each other. A background thread drops
+// sessions that were not accessed within the idle timeout, and the memory
+// reserved by all grids together is kept under a fixed limit.
+class session_registry_t
+{
+public:
+    // on_evict, when given, is called with the id of every session dropped
+    // for being idle, after it left the table
+    session_registry_t(size_t memory_limit, std::chrono::seconds idle_timeout,
+                       std::function<void(const std::string &)> on_evict = nullptr);
+    ~session_registry_t();
+
+    std::shared_ptr<session_t> create();
+
+    // Returns the session with the given id, creating it when there is none,
+    // so that a saved session comes back under its old id. Sets created to
+    // whether it is new.
+    std::shared_ptr<session_t> find_or_create(const std::string &id, bool &created);
+
+    // Returns the session with the given id and marks it as accessed, or null
+    std::shared_ptr<session_t> find(const std::string &id);
+
+    void erase(const std::string &id);
+
+    // Reserves memory for a width x height grid in the session, replacing its
+    // previous reservation. Evicts idle sessions when needed and returns false
+    // when the limit would still be exceeded. Call with the session mutex held.
+    bool reserve(session_t &session, uint32_t width, uint32_t height);
+
+    size_t memory() const { return memory_; }
+    size_t size() const;
+
+    // The live sessions at the time of the call, without marking them accessed
+    std::vector<std::shared_ptr<session_t>> list() const;
+
+private:
+    struct shard_t
+    {
+        mutable std::mutex mutex;
+        std::unordered_map<std::string, std::shared_ptr<session_t>> sessions;
+    };
+
+    shard_t &shard(const std::string &id) { return shards_[std::hash<std::string>()(id) % SESSION_SHARDS]; }
+    void evict_idle();
+    void run();
+
+    const size_t memory_limit_;
+    const std::chrono::seconds idle_timeout_;
+    const std::function<void(const std::string &)> on_evict_;
+    std::atomic<size_t> memory_{0};
+    shard_t shards_[SESSION_SHARDS];
+
+    std::mutex janitor_mutex_;
+    std::condition_variable janitor_wake_;
+    bool stopping_ = false;
+    std::thread janitor_;
+};
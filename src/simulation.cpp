@@ -0,0 +1,302 @@
+#include "simulation.hpp"
+#include "metrics.hpp"
+#include "serialize.hpp"
+
+#include <algorithm>
+
+namespace
+{
+    // Everything start_world does short of placing the entities
+    void configure_world(world_t &world, const simulation_config_t &config)
+    {
+        world.set_threads(config.threads);
+        world.set_species(config.species);
+        world.set_topology(config.topology);
+        world.reset(config.width, config.height, config.seed);
+    }
+}
+
+bool snapshot_t::changed_since(uint64_t base_tick, std::vector<uint32_t> &cells) const
+{
+    cells.clear();
+    if (base_tick > tick)
+        return false;
+    if (base_tick == tick)
+        return true;
+    if (history.empty() || history.front()->base_tick > base_tick)
+        return false;
+
+    // A base inside an interval gets all of that interval's cells, a superset of what it needs
+    size_t merged = 0;
+    for (const std::shared_ptr<const snapshot_changes_t> &changes : history)
+    {
+        if (changes->tick <= base_tick)
+            continue;
+        cells.insert(cells.end(), changes->cells.begin(), changes->cells.end());
+        ++merged;
+    }
+    if (merged > 1)
+    {
+        std::sort(cells.begin(), cells.end());
+        cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+    }
+    return true;
+}
+
+// Readers get an empty grid until the first start
+simulation_t::simulation_t() : snapshot_(std::make_shared<snapshot_t>())
+{
+}
+
+void write_snapshot_frame(const snapshot_t &snapshot, uint64_t run, uint64_t since, bool binary, std::string &out)
+{
+    static thread_local std::vector<uint32_t> cells;
+    const grid_t &grid = snapshot.grid;
+    const bool delta = run == snapshot.run && snapshot.changed_since(since, cells) &&
+                       cells.size() * DELTA_CELL_BYTES < grid.size() * FRAME_CELL_BYTES;
+    if (binary)
+    {
+        if (delta)
+            write_delta_binary(grid, since, snapshot.tick, cells, out);
+        else
+            write_grid_binary(grid, snapshot.tick, out);
+    }
+    else
+    {
+        if (delta)
+            write_delta_json(grid, snapshot.symbols, since, snapshot.tick, cells, out);
+        else
+            write_keyframe_json(grid, snapshot.symbols, snapshot.tick, out);
+    }
+}
+
+simulation_t::~simulation_t()
+{
+    stop();
+}
+
+void start_world(world_t &world, const simulation_config_t &config)
+{
+    configure_world(world, config);
+    world.populate(config.counts);
+}
+
+std::shared_ptr<const snapshot_t> simulation_t::start(const simulation_config_t &config)
+{
+    return launch(config, 0, nullptr);
+}
+
+std::shared_ptr<const snapshot_t> simulation_t::restore(const simulation_config_t &config, uint64_t tick,
+                                                        const grid_t &grid)
+{
+    return launch(config, tick, &grid);
+}
+
+std::shared_ptr<const snapshot_t> simulation_t::launch(const simulation_config_t &config, uint64_t tick,
+                                                       const grid_t *grid)
+{
+    std::lock_guard<std::mutex> control(control_mutex_);
+    stop_runner();
+
+    std::shared_ptr<const snapshot_t> first;
+    {
+        std::lock_guard<std::mutex> lock(world_mutex_);
+        {
+            scoped_timer_t timer(PHASE_PLACEMENT);
+            if (grid)
+            {
+                configure_world(world_, config);
+                world_.restore(*grid, tick);
+            }
+            else
+                start_world(world_, config);
+        }
+        config_ = std::make_shared<const simulation_config_t>(config);
+        background_ = config.background;
+        ++run_;
+
+        pending_.assign((world_.grid().size() + 63) / 64, 0);
+        pending_count_ = 0;
+        published_tick_ = world_.tick();
+        history_.clear();
+        history_cells_ = 0;
+        publish_locked();
+        first = std::atomic_load(&snapshot_);
+    }
+
+    if (config.background)
+    {
+        stopping_ = false;
+        runner_ = std::thread(&simulation_t::run, this, config.tick_rate);
+    }
+    return first;
+}
+
+void simulation_t::stop()
+{
+    std::lock_guard<std::mutex> control(control_mutex_);
+    stop_runner();
+}
+
+void simulation_t::stop_runner()
+{
+    if (!runner_.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(runner_mutex_);
+        stopping_ = true;
+    }
+    runner_wake_.notify_all();
+    runner_.join();
+}
+
+std::shared_ptr<const snapshot_t> simulation_t::advance(uint32_t steps, std::vector<population_t> *populations)
+{
+    using clock = std::chrono::steady_clock;
+    // The runner holds the world lock for every tick, readers of a background
+    // run only take what it last published
+    if (background_)
+        return std::atomic_load(&snapshot_);
+
+    std::lock_guard<std::mutex> lock(world_mutex_);
+    // A background start may have raced the check above
+    if (!background_)
+    {
+        clock::time_point last_publish = clock::now();
+        for (uint32_t k = 0; k < steps; ++k)
+        {
+            step_locked();
+            if (populations)
+                populations->push_back(world_.population());
+            if (k + 1 < steps && clock::now() - last_publish >= SNAPSHOT_INTERVAL)
+            {
+                publish_locked();
+                last_publish = clock::now();
+            }
+        }
+        publish_locked();
+    }
+    return std::atomic_load(&snapshot_);
+}
+
+std::shared_ptr<const snapshot_t> simulation_t::snapshot() const
+{
+    return std::atomic_load(&snapshot_);
+}
+
+void simulation_t::run(double tick_rate)
+{
+    using clock = std::chrono::steady_clock;
+    const clock::duration period = tick_rate > 0 ? std::chrono::duration_cast<clock::duration>(
+                                                       std::chrono::duration<double>(1.0 / tick_rate))
+                                                 : clock::duration::zero();
+    // Slow runs publish every tick, fast ones at most once per SNAPSHOT_INTERVAL
+    const bool publish_every_tick = period >= SNAPSHOT_INTERVAL;
+
+    clock::time_point deadline = clock::now();
+    clock::time_point last_publish = deadline;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(runner_mutex_);
+            if (period > clock::duration::zero())
+            {
+                // A stepper that fell behind skips the missed ticks instead of bursting
+                deadline = std::max(deadline + period, clock::now());
+                runner_wake_.wait_until(lock, deadline, [this]
+                                        { return stopping_; });
+            }
+            if (stopping_)
+                break;
+        }
+
+        std::lock_guard<std::mutex> lock(world_mutex_);
+        step_locked();
+        const clock::time_point now = clock::now();
+        if (publish_every_tick || now - last_publish >= SNAPSHOT_INTERVAL)
+        {
+            publish_locked();
+            last_publish = now;
+        }
+    }
+
+    // Readers see the state the run stopped at
+    std::lock_guard<std::mutex> lock(world_mutex_);
+    publish_locked();
+}
+
+void simulation_t::step_locked()
+{
+    world_.step();
+    for (uint32_t idx : world_.last_changes())
+    {
+        const uint64_t bit = 1ull << (idx % 64);
+        uint64_t &word = pending_[idx / 64];
+        pending_count_ += !(word & bit);
+        word |= bit;
+    }
+}
+
+void simulation_t::publish_locked()
+{
+    scoped_timer_t timer(PHASE_PUBLISH);
+    const grid_t &grid = world_.grid();
+    if (world_.tick() != published_tick_)
+    {
+        std::shared_ptr<snapshot_changes_t> changes = std::make_shared<snapshot_changes_t>();
+        changes->base_tick = published_tick_;
+        changes->tick = world_.tick();
+        changes->cells.reserve(pending_count_);
+        for (size_t w = 0; w < pending_.size() && changes->cells.size() < pending_count_; ++w)
+        {
+            for (uint64_t bits = pending_[w]; bits; bits &= bits - 1)
+                changes->cells.push_back((uint32_t)(w * 64 + __builtin_ctzll(bits)));
+            pending_[w] = 0;
+        }
+        pending_count_ = 0;
+
+        // Same bound as the change log: past one grid of cells a keyframe is cheaper
+        history_cells_ += changes->cells.size();
+        history_.push_back(std::move(changes));
+        size_t dropped = 0;
+        while (history_.size() - dropped > 1 &&
+               (history_.size() - dropped > SNAPSHOT_HISTORY || history_cells_ > grid.size()))
+            history_cells_ -= history_[dropped++]->cells.size();
+        history_.erase(history_.begin(), history_.begin() + dropped);
+        published_tick_ = world_.tick();
+    }
+
+    std::unique_ptr<snapshot_t> next;
+    {
+        std::lock_guard<std::mutex> lock(recycled_->mutex);
+        if (!recycled_->free.empty())
+        {
+            next = std::move(recycled_->free.back());
+            recycled_->free.pop_back();
+        }
+    }
+    if (!next)
+        next.reset(new snapshot_t);
+    next->run = run_;
+    next->tick = world_.tick();
+    next->seed = world_.seed();
+    next->symbols = world_.species().symbols();
+    next->config = config_;
+    next->population = world_.population();
+    next->grid = grid;
+    next->history = history_;
+
+    // The last reader to let go hands the snapshot back through the pool mutex,
+    // which orders its reads before the next refill
+    std::shared_ptr<snapshot_t> published(next.release(), [recycled = recycled_](snapshot_t *snapshot)
+                                          {
+        snapshot->history.clear();
+        snapshot->config.reset();
+        std::unique_ptr<snapshot_t> owned(snapshot);
+        std::lock_guard<std::mutex> lock(recycled->mutex);
+        if (recycled->free.size() < SNAPSHOT_SPARES)
+            recycled->free.push_back(std::move(owned)); });
+    std::atomic_store(&snapshot_, std::move(published));
+    if (listener_)
+        listener_();
+}
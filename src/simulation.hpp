@@ -0,0 +1,146 @@
+#pragma once
+
+#include "world.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Number of published snapshots whose changed cells are kept for deltas
+const size_t SNAPSHOT_HISTORY = 64;
+
+// Released snapshots kept for reuse, enough for the usual case of one
+// reader still serializing the previous tick
+const size_t SNAPSHOT_SPARES = 2;
+
+// Minimum time between two snapshots when stepping in the background
+const std::chrono::milliseconds SNAPSHOT_INTERVAL{16};
+
+struct simulation_config_t
+{
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint64_t seed = 0;
+    unsigned threads = 1;
+    species_table_t species = classic_species();
+    std::vector<uint32_t> counts; // Initial entities of each species, in table order
+    topology_t topology;
+    bool background = false; // Steps on its own thread instead of once per request
+    double tick_rate = 0;    // Ticks per second in the background, 0 runs flat-out
+};
+
+// Cells written between two published ticks, sorted and without repetitions
+struct snapshot_changes_t
+{
+    uint64_t base_tick = 0;
+    uint64_t tick = 0;
+    std::vector<uint32_t> cells;
+};
+
+// Immutable copy of the world handed to readers. The change history is shared
+// between consecutive snapshots, so publishing one only copies the grid.
+struct snapshot_t
+{
+    uint64_t run = 0; // Changes on every start, ticks of different runs are unrelated
+    uint64_t tick = 0;
+    uint64_t seed = 0;
+    std::string symbols; // JSON character of each entity type
+    std::shared_ptr<const simulation_config_t> config; // Settings the run started with
+    population_t population;
+    grid_t grid;
+    std::vector<std::shared_ptr<const snapshot_changes_t>> history; // Oldest first
+
+    // Sorted cells that changed after the given tick, false when the history
+    // does not reach back that far
+    bool changed_since(uint64_t base_tick, std::vector<uint32_t> &cells) const;
+};
+
+// Writes the cells of the snapshot changed since the given tick of the given
+// run, or a keyframe when the base belongs to another run, the history does
+// not reach back that far or a full frame is smaller
+void write_snapshot_frame(const snapshot_t &snapshot, uint64_t run, uint64_t since, bool binary, std::string &out);
+
+// Sets up a world for the run the config describes: threads, rules,
+// topology, grid size, seed and initial entities
+void start_world(world_t &world, const simulation_config_t &config);
+
+// Owns a world and the thread that steps it. The world has a single writer
+// at a time, either the background thread or the request that advances it,
+// and readers never touch it. They atomically load the latest published
+// snapshot, which stays valid for as long as they hold it, so a read never
+// waits for a tick and a tick never waits for the readers.
+class simulation_t
+{
+public:
+    simulation_t();
+    ~simulation_t();
+
+    // Stops the current run, builds a new world and returns its first snapshot
+    std::shared_ptr<const snapshot_t> start(const simulation_config_t &config);
+
+    // Like start, but resumes a saved run at the given tick and grid instead
+    // of placing the initial entities
+    std::shared_ptr<const snapshot_t> restore(const simulation_config_t &config, uint64_t tick, const grid_t &grid);
+
+    // Stops the background thread, keeping the last state published
+    void stop();
+
+    // Steps the given number of ticks in manual mode. In the background it
+    // only returns the latest snapshot, without waiting for the tick in
+    // progress. Long batches publish at most once per SNAPSHOT_INTERVAL and
+    // always after the last tick. When populations is given, the population
+    // after each tick is appended to it. Returns the snapshot to answer with,
+    // which concurrent steps cannot change.
+    std::shared_ptr<const snapshot_t> advance(uint32_t steps = 1, std::vector<population_t> *populations = nullptr);
+
+    std::shared_ptr<const snapshot_t> snapshot() const;
+
+    // Called on the stepping thread after each publish, set before the first start
+    void set_listener(std::function<void()> listener) { listener_ = std::move(listener); }
+
+private:
+    std::shared_ptr<const snapshot_t> launch(const simulation_config_t &config, uint64_t tick, const grid_t *grid);
+    void run(double tick_rate);
+    void stop_runner();
+    void step_locked();
+    void publish_locked();
+
+    mutable std::mutex control_mutex_; // Serializes start and stop
+    std::mutex world_mutex_;           // Held by whoever steps the world
+    world_t world_;
+    std::atomic<bool> background_{false}; // Mode of the current run, read without world_mutex_
+    uint64_t run_ = 0;
+    std::shared_ptr<const simulation_config_t> config_; // Settings of the current run
+
+    // Bitmap of the cells changed since the last snapshot, one bit per cell,
+    // walked in index order to list them sorted without a comparison sort
+    std::vector<uint64_t> pending_;
+    size_t pending_count_ = 0;
+    uint64_t published_tick_ = 0;
+    std::vector<std::shared_ptr<const snapshot_changes_t>> history_;
+    size_t history_cells_ = 0;
+
+    // Snapshots released by all their readers, refilled instead of reallocated.
+    // Shared with the deleters, which may run after the simulation is gone.
+    struct snapshot_pool_t
+    {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<snapshot_t>> free;
+    };
+    std::shared_ptr<snapshot_pool_t> recycled_ = std::make_shared<snapshot_pool_t>();
+
+    // Only accessed through std::atomic_load and std::atomic_exchange
+    std::shared_ptr<snapshot_t> snapshot_;
+    std::function<void()> listener_;
+
+    std::thread runner_;
+    std::mutex runner_mutex_;
+    std::condition_variable runner_wake_;
+    bool stopping_ = false;
+};
@@ -0,0 +1,104 @@
+#include "species.hpp"
+
+#include <algorithm>
+
+unsigned species_table_t::find(const std::string &name) const
+{
+    for (size_t k = 0; k < species.size(); ++k)
+        if (species[k].name == name)
+            return (unsigned)k + 1;
+    return 0;
+}
+
+std::string species_table_t::symbols() const
+{
+    std::string symbols(1, ' ');
+    for (const species_t &s : species)
+        symbols += s.symbol;
+    return symbols;
+}
+
+aging_rules_t species_table_t::aging_rules() const
+{
+    aging_rules_t rules;
+    rules.types = (unsigned)species.size() + 1;
+    for (unsigned type = 1; type < rules.types; ++type)
+    {
+        const species_t &s = (*this)[type];
+        rules.maximum_age[type] = (int16_t)std::min<int32_t>(s.maximum_age, INT16_MAX);
+        rules.starves[type] = s.uses_energy;
+    }
+    return rules;
+}
+
+bool species_table_t::trophic_levels(std::vector<unsigned> &levels) const
+{
+    // Relaxing the predator -> prey edges once per species settles every
+    // level of an acyclic web, a change on the extra round means a cycle
+    const unsigned types = (unsigned)species.size() + 1;
+    levels.assign(types, 0);
+    for (unsigned round = 0; round <= types; ++round)
+    {
+        bool changed = false;
+        for (unsigned predator = 1; predator < types; ++predator)
+        {
+            for (unsigned type = 1; type < types; ++type)
+            {
+                if (((*this)[predator].prey >> type & 1) && levels[type] < levels[predator] + 1)
+                {
+                    levels[type] = levels[predator] + 1;
+                    changed = true;
+                }
+            }
+        }
+        if (!changed)
+            return true;
+    }
+    return false;
+}
+
+const species_table_t &classic_species()
+{
+    static const species_table_t table = []
+    {
+        species_t plants;
+        plants.name = "plant";
+        plants.symbol = 'P';
+        plants.maximum_age = PLANT_MAXIMUM_AGE;
+        plants.reproduction_probability = PLANT_REPRODUCTION_PROBABILITY;
+
+        species_t herbivores;
+        herbivores.name = "herbivore";
+        herbivores.symbol = 'H';
+        herbivores.maximum_age = HERBIVORE_MAXIMUM_AGE;
+        herbivores.uses_energy = true;
+        herbivores.initial_energy = INITIAL_ENERGY;
+        herbivores.prey = 1u << plant;
+        herbivores.eat_probability = HERBIVORE_EAT_PROBABILITY;
+        herbivores.energy_gain = HERBIVORE_ENERGY_GAIN;
+        herbivores.move_probability = HERBIVORE_MOVE_PROBABILITY;
+        herbivores.move_cost = MOVE_ENERGY_COST;
+        herbivores.reproduction_probability = HERBIVORE_REPRODUCTION_PROBABILITY;
+        herbivores.reproduction_threshold = THRESHOLD_ENERGY_FOR_REPRODUCTION;
+        herbivores.reproduction_cost = REPRODUCTION_ENERGY_COST;
+        herbivores.offspring_energy = OFFSPRING_ENERGY;
+
+        // Carnivores reach diagonals and take every herbivore in reach
+        species_t carnivores = herbivores;
+        carnivores.name = "carnivore";
+        carnivores.symbol = 'C';
+        carnivores.maximum_age = CARNIVORE_MAXIMUM_AGE;
+        carnivores.prey = 1u << herbivore;
+        carnivores.eat_probability = CARNIVORE_EAT_PROBABILITY;
+        carnivores.energy_gain = CARNIVORE_ENERGY_GAIN;
+        carnivores.eat_range = 8;
+        carnivores.eats_all = true;
+        carnivores.move_probability = CARNIVORE_MOVE_PROBABILITY;
+        carnivores.reproduction_probability = CARNIVORE_REPRODUCTION_PROBABILITY;
+
+        species_table_t table;
+        table.species = {plants, herbivores, carnivores};
+        return table;
+    }();
+    return table;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "aging.hpp"
+#include "grid.hpp"
+
+#include <string>
+#include <vector>
+
+// Constants of the classic species
+const uint32_t PLANT_MAXIMUM_AGE = 10;
+const uint32_t HERBIVORE_MAXIMUM_AGE = 50;
+const uint32_t CARNIVORE_MAXIMUM_AGE = 80;
+const uint32_t MAXIMUM_ENERGY = 200;
+const uint32_t THRESHOLD_ENERGY_FOR_REPRODUCTION = 20;
+const int32_t INITIAL_ENERGY = 100;
+const int32_t OFFSPRING_ENERGY = 20;
+const int32_t MOVE_ENERGY_COST = 5;
+const int32_t REPRODUCTION_ENERGY_COST = 10;
+const int32_t HERBIVORE_ENERGY_GAIN = 30;
+const int32_t CARNIVORE_ENERGY_GAIN = 20;
+
+// Probabilities
+const double PLANT_REPRODUCTION_PROBABILITY = 0.2;
+const double HERBIVORE_REPRODUCTION_PROBABILITY = 0.075;
+const double CARNIVORE_REPRODUCTION_PROBABILITY = 0.025;
+const double HERBIVORE_MOVE_PROBABILITY = 0.7;
+const double HERBIVORE_EAT_PROBABILITY = 0.9;
+const double CARNIVORE_MOVE_PROBABILITY = 0.5;
+const double CARNIVORE_EAT_PROBABILITY = 1.0;
+
+// Rules of one species, probabilities are per tick
+struct species_t
+{
+    std::string name;
+    char symbol = '?';               // Character of its cells in JSON frames
+    int32_t maximum_age = INT16_MAX; // Dies once older than this
+
+    // Species with energy starve once it runs out and only reproduce above a
+    // threshold. The others never starve and grow into free cells whatever
+    // their energy.
+    bool uses_energy = false;
+    int32_t initial_energy = 0;
+
+    uint16_t prey = 0; // Bit t set when it eats entity type t
+    double eat_probability = 0;
+    int32_t energy_gain = 0; // Per prey eaten
+    unsigned eat_range = 4;  // Neighbors it reaches, 4 (von Neumann) or 8 (Moore)
+    bool eats_all = false;   // Claims every prey in range instead of one at random
+
+    double move_probability = 0;
+    int32_t move_cost = 0;
+
+    double reproduction_probability = 0;
+    int32_t reproduction_threshold = 0; // Reproduces only with more energy than this
+    int32_t reproduction_cost = 0;
+    int32_t offspring_energy = 0;
+};
+
+// Species of a run. Entity type t is species[t - 1], since type 0 marks an
+// empty cell.
+struct species_table_t
+{
+    std::vector<species_t> species;
+
+    size_t size() const { return species.size(); }
+    const species_t &operator[](unsigned type) const { return species[type - 1]; }
+
+    // Entity type of the named species, 0 when there is none
+    unsigned find(const std::string &name) const;
+
+    // Character of each entity type, a space for empty cells first
+    std::string symbols() const;
+
+    aging_rules_t aging_rules() const;
+
+    // Fills levels[t] with the trophic level of type t: 0 for species nothing
+    // eats, otherwise one more than their highest predator, so predators always
+    // come first. Returns false when the food web has a cycle.
+    bool trophic_levels(std::vector<unsigned> &levels) const;
+};
+
+// Plants, herbivores and carnivores with the rules of the original exercise
+const species_table_t &classic_species();
@@ -0,0 +1,168 @@
+#include "stream.hpp"
+#include "serialize.hpp"
+
+#include <vector>
+
+stream_hub_t::stream_hub_t() : thread_(&stream_hub_t::run, this)
+{
+}
+
+stream_hub_t::~stream_hub_t()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    thread_.join();
+
+    // Simulations released here may still publish and call notify
+    std::unordered_map<const void *, client_t> clients;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        clients.swap(clients_);
+    }
+}
+
+void stream_hub_t::subscribe(const void *key, std::shared_ptr<simulation_t> simulation, sender_t send)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        client_t &client = clients_[key];
+        client = client_t{};
+        client.id = ++next_id_;
+        client.simulation = std::move(simulation);
+        client.send = std::move(send);
+        pending_ = true;
+    }
+    wake_.notify_one();
+}
+
+void stream_hub_t::unsubscribe(const void *key)
+{
+    // The simulation may be released here, outside the lock
+    std::shared_ptr<simulation_t> simulation;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = clients_.find(key);
+    if (it != clients_.end())
+    {
+        simulation = std::move(it->second.simulation);
+        clients_.erase(it);
+    }
+}
+
+bool stream_hub_t::acknowledge(const void *key)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = clients_.find(key);
+        if (it == clients_.end())
+            return false;
+        if (it->second.ready)
+            return true;
+        it->second.ready = true;
+        pending_ = true;
+    }
+    wake_.notify_one();
+    return true;
+}
+
+void stream_hub_t::notify()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_ = true;
+    }
+    wake_.notify_one();
+}
+
+void stream_hub_t::run()
+{
+    // Clients due a frame, and the frames written this round. Clients of the
+    // same simulation that are in sync share one frame.
+    struct due_t
+    {
+        const void *key;
+        uint64_t id;
+        std::shared_ptr<const snapshot_t> snapshot;
+        bool keyframe;
+        uint64_t tick;
+    };
+    struct frame_t
+    {
+        const snapshot_t *snapshot;
+        bool keyframe;
+        uint64_t tick;
+        std::string data;
+    };
+    std::vector<due_t> due;
+    std::vector<frame_t> frames; // The strings keep their capacity across rounds
+    size_t frame_count = 0;
+    auto find_frame = [&](const due_t &client) -> frame_t *
+    {
+        for (size_t k = 0; k < frame_count; ++k)
+            if (frames[k].snapshot == client.snapshot.get() && frames[k].keyframe == client.keyframe &&
+                (client.keyframe || frames[k].tick == client.tick))
+                return &frames[k];
+        return nullptr;
+    };
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;)
+    {
+        wake_.wait(lock, [this]
+                   { return pending_ || stopping_; });
+        if (stopping_)
+            return;
+        pending_ = false;
+
+        due.clear();
+        for (const auto &entry : clients_)
+        {
+            const client_t &client = entry.second;
+            if (!client.ready)
+                continue;
+            std::shared_ptr<const snapshot_t> snapshot = client.simulation->snapshot();
+            const bool keyframe = !client.has_tick || client.run != snapshot->run;
+            if (keyframe || client.tick != snapshot->tick)
+                due.push_back({entry.first, client.id, std::move(snapshot), keyframe, client.tick});
+        }
+        if (due.empty())
+            continue;
+
+        // Frames are written without holding the lock, so acknowledgements keep flowing
+        lock.unlock();
+        frame_count = 0;
+        for (const due_t &client : due)
+        {
+            if (find_frame(client))
+                continue;
+            if (frame_count == frames.size())
+                frames.emplace_back();
+            frame_t &frame = frames[frame_count++];
+            frame.snapshot = client.snapshot.get();
+            frame.keyframe = client.keyframe;
+            frame.tick = client.tick;
+            if (client.keyframe)
+                write_grid_binary(client.snapshot->grid, client.snapshot->tick, frame.data);
+            else
+                write_snapshot_frame(*client.snapshot, client.snapshot->run, client.tick, true, frame.data);
+        }
+        lock.lock();
+
+        // Clients that left or reconnected meanwhile are skipped
+        for (const due_t &entry : due)
+        {
+            auto it = clients_.find(entry.key);
+            if (it == clients_.end() || it->second.id != entry.id)
+                continue;
+            client_t &client = it->second;
+            client.send(find_frame(entry)->data);
+            client.ready = false;
+            client.has_tick = true;
+            client.run = entry.snapshot->run;
+            client.tick = entry.snapshot->tick;
+        }
+        due.clear(); // Releases the snapshots
+    }
+}
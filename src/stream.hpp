@@ -0,0 +1,57 @@
+#pragma once
+
+#include "simulation.hpp"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+// Pushes the frames of simulations to streaming subscribers, such as
+// WebSocket connections. Each client has at most one frame in flight: the
+// next one is sent when the client acknowledges the previous one, as a delta
+// from the last tick it received. A slow consumer therefore skips the ticks
+// published meanwhile instead of growing a queue on the server.
+class stream_hub_t
+{
+public:
+    using sender_t = std::function<void(const std::string &frame)>;
+
+    stream_hub_t();
+    ~stream_hub_t();
+
+    // Registers a client identified by key to the frames of a simulation, the
+    // first frame it gets is a keyframe
+    void subscribe(const void *key, std::shared_ptr<simulation_t> simulation, sender_t send);
+    void unsubscribe(const void *key);
+
+    // Called when the client has consumed its last frame, false for unknown clients
+    bool acknowledge(const void *key);
+
+    // Called after every snapshot a simulation publishes
+    void notify();
+
+private:
+    struct client_t
+    {
+        uint64_t id = 0;
+        std::shared_ptr<simulation_t> simulation;
+        sender_t send;
+        bool ready = true;      // No frame in flight
+        bool has_tick = false;  // Received at least one frame
+        uint64_t run = 0;       // Run and tick of the last frame sent
+        uint64_t tick = 0;
+    };
+
+    void run();
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::unordered_map<const void *, client_t> clients_;
+    uint64_t next_id_ = 0;
+    bool pending_ = false;
+    bool stopping_ = false;
+    std::thread thread_;
+};
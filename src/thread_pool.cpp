@@ -0,0 +1,81 @@
+#include "thread_pool.hpp"
+
+thread_pool_t::thread_pool_t(unsigned threads)
+{
+    for (unsigned t = 1; t < threads; ++t)
+        workers_.emplace_back([this]
+                              { worker_loop(); });
+}
+
+thread_pool_t::~thread_pool_t()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread &worker : workers_)
+        worker.join();
+}
+
+void thread_pool_t::drain(task_t task, void *ctx, size_t count)
+{
+    for (size_t i = next_.fetch_add(1, std::memory_order_relaxed); i < count;
+         i = next_.fetch_add(1, std::memory_order_relaxed))
+        task(ctx, i);
+}
+
+void thread_pool_t::run(size_t count, task_t task, void *ctx)
+{
+    if (workers_.empty() || count <= 1)
+    {
+        for (size_t i = 0; i < count; ++i)
+            task(ctx, i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        task_ = task;
+        ctx_ = ctx;
+        count_ = count;
+        next_.store(0, std::memory_order_relaxed);
+        active_ = workers_.size();
+        ++generation_;
+    }
+    wake_.notify_all();
+
+    drain(task, ctx, count);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this]
+               { return active_ == 0; });
+}
+
+void thread_pool_t::worker_loop()
+{
+    uint64_t seen = 0;
+    for (;;)
+    {
+        task_t task;
+        void *ctx;
+        size_t count;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [&]
+                       { return stopping_ || generation_ != seen; });
+            if (stopping_)
+                return;
+            seen = generation_;
+            task = task_;
+            ctx = ctx_;
+            count = count_;
+        }
+
+        drain(task, ctx, count);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--active_ == 0)
+            done_.notify_one();
+    }
+}
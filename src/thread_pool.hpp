@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed-size pool that runs indexed tasks in parallel. The calling thread
+// takes part in the work, so a pool of size 1 runs everything inline.
+class thread_pool_t
+{
+public:
+    explicit thread_pool_t(unsigned threads = 1);
+    ~thread_pool_t();
+
+    thread_pool_t(const thread_pool_t &) = delete;
+    thread_pool_t &operator=(const thread_pool_t &) = delete;
+
+    unsigned size() const { return (unsigned)workers_.size() + 1; }
+
+    // Calls fn(i) for every i in [0, count) and returns once all calls finished
+    template <typename F>
+    void parallel_for(size_t count, F &&fn)
+    {
+        using fn_t = std::remove_reference_t<F>;
+        run(count, [](void *ctx, size_t i)
+            { (*static_cast<fn_t *>(ctx))(i); },
+            const_cast<void *>(static_cast<const void *>(&fn)));
+    }
+
+private:
+    using task_t = void (*)(void *, size_t);
+
+    void run(size_t count, task_t task, void *ctx);
+    void drain(task_t task, void *ctx, size_t count);
+    void worker_loop();
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    uint64_t generation_ = 0;
+    bool stopping_ = false;
+    size_t active_ = 0;
+
+    task_t task_ = nullptr;
+    void *ctx_ = nullptr;
+    size_t count_ = 0;
+    std::atomic<size_t> next_{0};
+};
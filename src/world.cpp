@@ -0,0 +1,785 @@
+#include "world.hpp"
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <array>
+#include <thread>
+
+namespace
+{
+    struct offset_t
+    {
+        int32_t di;
+        int32_t dj;
+    };
+
+    // Neighbor directions: the first four form the von Neumann neighborhood,
+    // all eight the Moore neighborhood. Opposite directions differ in the last bit.
+    constexpr offset_t OFFSETS[8] = {
+        {-1, 0}, {1, 0}, {0, -1}, {0, 1}, {-1, -1}, {1, 1}, {-1, 1}, {1, -1}};
+    constexpr unsigned VON_NEUMANN = 4;
+    constexpr unsigned MOORE = 8;
+    constexpr uint8_t NO_DIRECTION = 0xFF;
+
+    // All 24 orderings of the von Neumann directions, so a random visiting
+    // order costs one table lookup instead of a shuffle
+    constexpr uint8_t PERMUTATIONS[24][VON_NEUMANN] = {
+        {0, 1, 2, 3}, {0, 1, 3, 2}, {0, 2, 1, 3}, {0, 2, 3, 1}, {0, 3, 1, 2}, {0, 3, 2, 1},
+        {1, 0, 2, 3}, {1, 0, 3, 2}, {1, 2, 0, 3}, {1, 2, 3, 0}, {1, 3, 0, 2}, {1, 3, 2, 0},
+        {2, 0, 1, 3}, {2, 0, 3, 1}, {2, 1, 0, 3}, {2, 1, 3, 0}, {2, 3, 0, 1}, {2, 3, 1, 0},
+        {3, 0, 1, 2}, {3, 0, 2, 1}, {3, 1, 0, 2}, {3, 1, 2, 0}, {3, 2, 0, 1}, {3, 2, 1, 0}};
+
+    inline unsigned opposite(unsigned dir) { return dir ^ 1u; }
+
+    // Maps 64 random bits to [0, range) with a multiply instead of a division
+    inline uint64_t scale(uint32_t high, uint32_t low, uint64_t range)
+    {
+        return (uint64_t)(((unsigned __int128)((uint64_t)high << 32 | low) * range) >> 64);
+    }
+
+    // Kinds of claims, part of the claim priority
+    enum claim_kind_t : unsigned
+    {
+        KIND_EAT,
+        KIND_MOVE,
+        KIND_SPAWN
+    };
+
+    // Actions that draw random numbers, part of the RNG counter
+    enum action_t : uint32_t
+    {
+        ACTION_HUNT,
+        ACTION_GRAZE,
+        ACTION_GROW,
+        ACTION_MOVE,
+        ACTION_REPRODUCE
+    };
+
+    using direction_order_t = uint8_t[VON_NEUMANN];
+
+    inline const direction_order_t &random_directions(uint32_t word)
+    {
+        return PERMUTATIONS[word % 24];
+    }
+
+    // First direction, in the random order picked by word, whose neighbor
+    // mask has the bit of cell k set
+    inline unsigned random_direction(const uint64_t *masks, unsigned k, uint32_t word)
+    {
+        for (uint8_t dir : random_directions(word))
+            if (masks[dir] >> k & 1)
+                return dir;
+        return NO_DIRECTION;
+    }
+
+    // Directions whose neighbor mask has the bit of cell k set, as a bitmask
+    inline uint8_t gather(const uint64_t *masks, unsigned directions, unsigned k)
+    {
+        uint8_t mask = 0;
+        for (unsigned dir = 0; dir < directions; ++dir)
+            mask |= (uint8_t)((masks[dir] >> k & 1) << dir);
+        return mask;
+    }
+
+    // Position of the n-th set bit of a direction mask
+    inline unsigned nth_direction(uint8_t mask, unsigned n)
+    {
+        for (; n > 0; --n)
+            mask &= mask - 1;
+        return __builtin_ctz(mask);
+    }
+
+    // Random direction among the first `directions` whose mask has the bit of
+    // cell k set, or NO_DIRECTION
+    inline unsigned free_direction(const uint64_t *masks, unsigned directions, unsigned k, uint32_t word)
+    {
+        if (directions == VON_NEUMANN)
+            return random_direction(masks, k, word);
+        const uint8_t options = gather(masks, directions, k);
+        return options == 0 ? NO_DIRECTION : nth_direction(options, word % __builtin_popcount(options));
+    }
+
+    // Bitboard plane holding every occupied cell, the others are indexed by entity type
+    constexpr unsigned OCCUPIED = 0;
+
+    inline uint64_t mix64(uint64_t x)
+    {
+        x += 0x9E3779B97F4A7C15ull;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+        return x ^ (x >> 31);
+    }
+
+    // Moves a coordinate that stepped one cell past an edge to the other side
+    inline uint32_t wrap(uint32_t x, uint32_t size)
+    {
+        if (x < size)
+            return x;
+        return x == size ? 0 : size - 1;
+    }
+}
+
+world_t::world_t() : aging_(aging_kernel()), pool_(new thread_pool_t(1))
+{
+    set_species(classic_species());
+}
+
+// Calls fn(i, j, idx) for every occupied cell of the tile in row-major order,
+// skipping empty space a 64-cell word at a time
+template <typename F>
+void world_t::for_each_occupied(size_t tile, F &&fn) const
+{
+    const grid_t &cur = *current_;
+    const uint32_t end = std::min(cur.height, (uint32_t)(tile + 1) * TILE_ROWS);
+    for (uint32_t i = (uint32_t)tile * TILE_ROWS; i < end; ++i)
+    {
+        const uint64_t *row = board_row(OCCUPIED, i);
+        for (size_t w = 0; w < row_words_; ++w)
+        {
+            for (uint64_t bits = row[w]; bits != 0; bits &= bits - 1)
+            {
+                const uint32_t j = (uint32_t)(w * 64 + __builtin_ctzll(bits));
+                fn(i, j, cur.index(i, j));
+            }
+        }
+    }
+}
+
+// Calls fn(i, w, first) for every bitboard word of the tile holding at least
+// one entity, first being the index of the word's first cell
+template <typename F>
+void world_t::for_each_word(size_t tile, F &&fn) const
+{
+    const grid_t &cur = *current_;
+    const uint32_t end = std::min(cur.height, (uint32_t)(tile + 1) * TILE_ROWS);
+    for (uint32_t i = (uint32_t)tile * TILE_ROWS; i < end; ++i)
+    {
+        const uint64_t *row = board_row(OCCUPIED, i);
+        for (size_t w = 0; w < row_words_; ++w)
+            if (row[w] != 0)
+                fn(i, w, cur.index(i, (uint32_t)(w * 64)));
+    }
+}
+
+void world_t::set_threads(unsigned threads, bool oversubscribe)
+{
+    // Past one thread per core the workers only contend with each other
+    threads = std::max(threads, 1u);
+    if (!oversubscribe)
+        threads = std::min(threads, std::max(std::thread::hardware_concurrency(), 1u));
+    if (threads != pool_->size())
+        pool_.reset(new thread_pool_t(threads));
+}
+
+void world_t::set_species(const species_table_t &species)
+{
+    species_ = species;
+    aging_rules_ = species.aging_rules();
+    species.trophic_levels(level_);
+
+    const unsigned types = (unsigned)species.size() + 1;
+    levels_.assign(*std::max_element(level_.begin(), level_.end()) + 1, {});
+    for (unsigned type = 1; type < types; ++type)
+    {
+        levels_[level_[type]].push_back(type);
+        threats_[type] = 0;
+        threat_range_[type] = 0;
+    }
+    for (unsigned predator = 1; predator < types; ++predator)
+    {
+        for (unsigned type = 1; type < types; ++type)
+        {
+            if (species[predator].prey >> type & 1)
+            {
+                threats_[type] |= 1u << predator;
+                threat_range_[type] = std::max(threat_range_[type], species[predator].eat_range);
+            }
+        }
+    }
+}
+
+void world_t::set_topology(const topology_t &topology)
+{
+    topology_ = topology;
+}
+
+void world_t::reset(uint32_t width, uint32_t height, uint64_t seed)
+{
+    rng_.seed = seed;
+    buffers_[0].assign(width, height);
+    buffers_[1].assign(width, height);
+    current_ = &buffers_[0];
+    next_ = &buffers_[1];
+    tick_ = 0;
+
+    const size_t cells = (size_t)width * height;
+    eat_.assign(cells, 0);
+    won_.assign(cells, 0);
+    move_.assign(cells, NO_DIRECTION);
+    spawn_.assign(cells, NO_DIRECTION);
+    eaten_.assign(cells, 0);
+    dirty_.assign(tile_count(), {});
+    vacated_.assign(tile_count(), {});
+    changes_.reset(cells);
+    row_words_ = (width + 63) / 64;
+    boards_.assign((species_.size() + 1) * height * row_words_, 0);
+}
+
+void world_t::place(size_t idx, entity_type_t type, int32_t energy)
+{
+    current_->set(idx, type, energy, 0);
+    next_->set(idx, type, energy, 0);
+    const uint32_t i = (uint32_t)(idx / current_->width);
+    const uint32_t j = (uint32_t)(idx % current_->width);
+    const uint64_t bit = 1ull << (j % 64);
+    for (unsigned plane = 0; plane <= species_.size(); ++plane)
+        board_row(plane, i)[j / 64] &= ~bit;
+    if (type != empty)
+    {
+        board_row(OCCUPIED, i)[j / 64] |= bit;
+        board_row(type, i)[j / 64] |= bit;
+    }
+}
+
+void world_t::restore(const grid_t &grid, uint64_t tick)
+{
+    *current_ = grid;
+    *next_ = grid;
+    tick_ = tick;
+    std::fill(boards_.begin(), boards_.end(), 0);
+    for (uint32_t i = 0; i < grid.height; ++i)
+    {
+        const uint8_t *types = &grid.type[grid.index(i, 0)];
+        for (uint32_t j = 0; j < grid.width; ++j)
+        {
+            if (types[j] == empty)
+                continue;
+            const uint64_t bit = 1ull << (j % 64);
+            board_row(OCCUPIED, i)[j / 64] |= bit;
+            board_row(types[j], i)[j / 64] |= bit;
+        }
+    }
+}
+
+void world_t::populate(const std::vector<uint32_t> &counts)
+{
+    // Selection sampling: visiting the cells in order, each one is taken with
+    // probability (entities left) / (cells left) and given a species drawn in
+    // proportion to what remains of each. Every arrangement of the requested
+    // counts is equally likely, and the cost is one draw per cell visited
+    // whatever the density, where redrawing coordinates until an empty cell
+    // turns up slows down as the grid fills.
+    const size_t cells = current_->size();
+    std::vector<uint64_t> remaining(counts.begin(), counts.end());
+    uint64_t left = 0;
+    for (uint64_t count : remaining)
+        left += count;
+    for (size_t idx = 0; idx < cells && left > 0; ++idx)
+    {
+        const std::array<uint32_t, 4> words = rng_.draw(UINT64_MAX, idx, 0);
+        const uint64_t take = scale(words[1], words[0], cells - idx);
+        if (take >= left)
+            continue;
+
+        uint64_t pick = scale(words[3], words[2], left);
+        size_t k = 0;
+        while (pick >= remaining[k])
+            pick -= remaining[k++];
+        place(idx, (entity_type_t)(k + 1), species_[(unsigned)k + 1].initial_energy);
+        --remaining[k];
+        --left;
+    }
+}
+
+population_t world_t::population() const
+{
+    // Counted from the bitboards, 64 cells at a time
+    population_t counts(species_.size() + 1, 0);
+    const size_t words = (size_t)current_->height * row_words_;
+    uint64_t occupied = 0;
+    for (unsigned type = 1; type <= species_.size(); ++type)
+    {
+        const uint64_t *plane = boards_.data() + type * words;
+        uint64_t count = 0;
+        for (size_t k = 0; k < words; ++k)
+            count += __builtin_popcountll(plane[k]);
+        counts[type] = (uint32_t)count;
+        occupied += count;
+    }
+    counts[empty] = (uint32_t)(current_->size() - occupied);
+    return counts;
+}
+
+void world_t::step()
+{
+    scoped_timer_t tick(PHASE_STEP);
+    const size_t tiles = tile_count();
+    {
+        scoped_timer_t timer(PHASE_AGE);
+        pool_->parallel_for(tiles, [this](size_t tile)
+                            { age(tile); });
+    }
+    {
+        scoped_timer_t timer(PHASE_FEEDING);
+        for (unsigned level = 0; level + 1 < levels_.size(); ++level)
+            pool_->parallel_for(tiles, [this, level](size_t tile)
+                                { decide_feeding(tile, level); });
+    }
+    {
+        scoped_timer_t timer(PHASE_MOVEMENT);
+        pool_->parallel_for(tiles, [this](size_t tile)
+                            { decide_movement(tile); });
+    }
+    {
+        scoped_timer_t timer(PHASE_APPLY);
+        pool_->parallel_for(tiles, [this](size_t tile)
+                            { apply(tile); });
+    }
+
+    // Publish the updated grid and bring the stale buffer up to date
+    std::swap(current_, next_);
+    {
+        scoped_timer_t timer(PHASE_COPY_FORWARD);
+        pool_->parallel_for(tiles, [this](size_t tile)
+                            { copy_forward(tile); });
+    }
+    ++tick_;
+
+    changes_.append(tick_, dirty_);
+    for (std::vector<uint32_t> &dirty : dirty_)
+        dirty.clear();
+}
+
+bool world_t::neighbor(uint32_t i, uint32_t j, unsigned dir, size_t &out) const
+{
+    // Out-of-range coordinates wrap around to large unsigned values
+    uint32_t ni = i + OFFSETS[dir].di;
+    uint32_t nj = j + OFFSETS[dir].dj;
+    if (topology_.toroidal)
+    {
+        ni = wrap(ni, current_->height);
+        nj = wrap(nj, current_->width);
+    }
+    else if (!current_->contains(ni, nj))
+    {
+        return false;
+    }
+    out = current_->index(ni, nj);
+    return true;
+}
+
+uint64_t world_t::priority(size_t idx, unsigned kind) const
+{
+    return mix64(mix64(rng_.seed ^ mix64(tick_)) ^ ((uint64_t)idx << 2 | kind));
+}
+
+std::array<uint32_t, 4> world_t::draw(size_t idx, uint32_t action) const
+{
+    return rng_.draw(tick_, (uint32_t)idx, action);
+}
+
+// Whether the entity at (i, j) wins its claim to eat the neighbor in direction dir
+bool world_t::wins_eat(uint32_t i, uint32_t j, unsigned dir) const
+{
+    const size_t self = current_->index(i, j);
+    // Intents only point at cells inside the grid, a missing one wins nothing
+    size_t target = self;
+    if (!neighbor(i, j, dir, target))
+        return false;
+    const uint32_t ti = (uint32_t)(target / current_->width);
+    const uint32_t tj = (uint32_t)(target % current_->width);
+
+    for (unsigned k = 0; k < MOORE; ++k)
+    {
+        size_t other;
+        if (!neighbor(ti, tj, k, other) || other == self || current_->type[other] == empty)
+            continue;
+        if ((eat_[other] >> opposite(k) & 1) &&
+            std::make_pair(priority(other, KIND_EAT), other) > std::make_pair(priority(self, KIND_EAT), self))
+            return false;
+    }
+    return true;
+}
+
+// Whether the entity at (i, j) wins its move or spawn claim on the neighbor in direction dir
+bool world_t::wins_claim(uint32_t i, uint32_t j, unsigned dir, unsigned kind) const
+{
+    const size_t self = current_->index(i, j);
+    // Intents only point at cells inside the grid, a missing one wins nothing
+    size_t target = self;
+    if (!neighbor(i, j, dir, target))
+        return false;
+    const uint32_t ti = (uint32_t)(target / current_->width);
+    const uint32_t tj = (uint32_t)(target % current_->width);
+    const auto own = std::make_pair(priority(self, kind), self);
+
+    // Claims come from as far as entities move
+    const unsigned directions = topology_.neighborhood;
+    for (unsigned k = 0; k < directions; ++k)
+    {
+        size_t other;
+        if (!neighbor(ti, tj, k, other) || current_->type[other] == empty)
+            continue;
+        if (move_[other] == opposite(k) && (other != self || kind != KIND_MOVE) &&
+            std::make_pair(priority(other, KIND_MOVE), other) > own)
+            return false;
+        if (spawn_[other] == opposite(k) && (other != self || kind != KIND_SPAWN) &&
+            std::make_pair(priority(other, KIND_SPAWN), other) > own)
+            return false;
+    }
+    return true;
+}
+
+// Bit k is set when the neighbor in direction dir of cell (i, 64w + k) is set
+// on the given plane. Neighbors outside a bounded grid read as unset; on a
+// toroidal one the rows and the ends of each row wrap around.
+uint64_t world_t::adjacent(unsigned plane, uint32_t i, size_t w, unsigned dir) const
+{
+    const bool toroidal = topology_.toroidal;
+    uint32_t ni = i + OFFSETS[dir].di;
+    if (ni >= current_->height)
+    {
+        if (!toroidal)
+            return 0;
+        ni = wrap(ni, current_->height);
+    }
+    const uint64_t *row = board_row(plane, ni);
+    const size_t last = row_words_ - 1;
+    if (OFFSETS[dir].dj > 0)
+    {
+        uint64_t mask = row[w] >> 1 | (w < last ? row[w + 1] << 63 : 0);
+        if (toroidal && w == last)
+            mask |= (row[0] & 1) << ((current_->width - 1) % 64);
+        return mask;
+    }
+    if (OFFSETS[dir].dj < 0)
+    {
+        uint64_t mask = row[w] << 1 | (w > 0 ? row[w - 1] >> 63 : 0);
+        if (toroidal && w == 0)
+            mask |= row[last] >> ((current_->width - 1) % 64) & 1;
+        return mask;
+    }
+    return row[w];
+}
+
+// Fills masks with the cells next to an entity of the given types, bit t of
+// types standing for type t, in the first `directions` directions and returns
+// their union
+uint64_t world_t::adjacent_to(uint32_t types, uint32_t i, size_t w, unsigned directions, uint64_t *masks) const
+{
+    uint64_t any = 0;
+    for (unsigned dir = 0; dir < directions; ++dir)
+    {
+        masks[dir] = 0;
+        for (uint32_t rest = types; rest != 0; rest &= rest - 1)
+            masks[dir] |= adjacent(__builtin_ctz(rest), i, w, dir);
+        any |= masks[dir];
+    }
+    return any;
+}
+
+// Masks of the cells whose neighbor in each direction of the movement
+// neighborhood lies inside the grid and is empty
+uint64_t world_t::free_neighbors(uint32_t i, size_t w, uint64_t *masks) const
+{
+    const uint32_t last = current_->width - 1;
+    const unsigned directions = topology_.neighborhood;
+    uint64_t any = 0;
+    for (unsigned dir = 0; dir < directions; ++dir)
+    {
+        uint64_t inside = ~0ull;
+        if (!topology_.toroidal)
+        {
+            if (i + OFFSETS[dir].di >= current_->height)
+                inside = 0;
+            if (OFFSETS[dir].dj < 0 && w == 0)
+                inside &= ~1ull;
+            if (OFFSETS[dir].dj > 0 && last / 64 == w)
+                inside &= ~(1ull << (last % 64));
+        }
+        any |= masks[dir] = inside & ~adjacent(OCCUPIED, i, w, dir);
+    }
+    return any;
+}
+
+// Ages every entity of the tile in place and removes those that reached their
+// maximum age or starved, before any decision is taken. Whole bitmap words go
+// through the vector kernel; the ragged end of a row is aged cell by cell so
+// that no cell of the next row, which may belong to another tile, is written.
+void world_t::age(size_t tile)
+{
+    grid_t &cur = *current_;
+    std::vector<uint32_t> &vacated = vacated_[tile];
+    const uint32_t end = std::min(cur.height, (uint32_t)(tile + 1) * TILE_ROWS);
+    for (uint32_t i = (uint32_t)tile * TILE_ROWS; i < end; ++i)
+    {
+        uint64_t *row = board_row(OCCUPIED, i);
+        for (size_t w = 0; w < row_words_; ++w)
+        {
+            if (row[w] == 0)
+                continue;
+            const size_t first = cur.index(i, (uint32_t)(w * AGING_BLOCK));
+
+            // Intents of the previous tick are stale, reset the whole word
+            const size_t cells = std::min<size_t>(AGING_BLOCK, cur.width - w * AGING_BLOCK);
+            std::fill_n(&eat_[first], cells, 0);
+            std::fill_n(&eaten_[first], cells, 0);
+
+            uint64_t dead = 0;
+            if ((w + 1) * AGING_BLOCK <= cur.width)
+            {
+                dead = aging_(aging_rules_, &cur.type[first], &cur.energy[first], &cur.age[first]);
+            }
+            else
+            {
+                for (uint64_t bits = row[w]; bits != 0; bits &= bits - 1)
+                {
+                    const unsigned k = __builtin_ctzll(bits);
+                    const size_t idx = first + k;
+                    const uint8_t type = cur.type[idx];
+                    cur.age[idx] = saturate_int16(cur.age[idx] + 1);
+                    if (cur.age[idx] > aging_rules_.maximum_age[type] ||
+                        (aging_rules_.starves[type] && cur.energy[idx] <= 0))
+                        dead |= 1ull << k;
+                }
+            }
+
+            // The dead leave both buffers and the boards now, so their cells
+            // are free during this tick
+            row[w] &= ~dead;
+            for (; dead != 0; dead &= dead - 1)
+            {
+                const unsigned k = __builtin_ctzll(dead);
+                const size_t idx = first + k;
+                board_row(cur.type[idx], i)[w] &= ~(1ull << k);
+                cur.clear(idx);
+                next_->clear(idx);
+                vacated.push_back((uint32_t)idx);
+            }
+        }
+    }
+}
+
+// Sets eaten_ for the entities of the word that one of their predators claimed
+void world_t::mark_caught(unsigned type, uint32_t i, size_t w, size_t first, uint64_t members)
+{
+    if (threats_[type] == 0)
+        return;
+
+    // Only entities next to a predator can have been claimed
+    const unsigned range = threat_range_[type];
+    uint64_t hunters[MOORE];
+    const uint64_t exposed = members & adjacent_to(threats_[type], i, w, range, hunters);
+    for (uint64_t bits = exposed; bits != 0; bits &= bits - 1)
+    {
+        const unsigned k = __builtin_ctzll(bits);
+        const uint32_t j = (uint32_t)(w * 64 + k);
+        bool caught = false;
+        for (unsigned dir = 0; dir < range && !caught; ++dir)
+        {
+            size_t other;
+            caught = (hunters[dir] >> k & 1) && neighbor(i, j, dir, other) && (eat_[other] >> opposite(dir) & 1);
+        }
+        eaten_[first + k] = caught;
+    }
+}
+
+// Entities that were not caught claim every prey in reach, or one picked at random
+void world_t::claim_prey(unsigned type, uint32_t i, size_t w, size_t first, uint64_t members)
+{
+    const species_t &s = species_[type];
+    const unsigned directions = s.eat_range;
+    uint64_t food[MOORE];
+    const uint64_t hungry = members & adjacent_to(s.prey, i, w, directions, food);
+    for (uint64_t bits = hungry; bits != 0; bits &= bits - 1)
+    {
+        const unsigned k = __builtin_ctzll(bits);
+        const size_t idx = first + k;
+        if (eaten_[idx])
+            continue;
+        const std::array<uint32_t, 4> words = draw(idx, s.eats_all ? ACTION_HUNT : ACTION_GRAZE);
+        if (counter_rng_t::unit(words[0]) >= s.eat_probability)
+            continue;
+
+        if (s.eats_all)
+        {
+            eat_[idx] = gather(food, directions, k);
+        }
+        else if (directions == VON_NEUMANN)
+        {
+            eat_[idx] = (uint8_t)(1u << random_direction(food, k, words[1]));
+        }
+        else
+        {
+            const uint8_t options = gather(food, directions, k);
+            eat_[idx] = (uint8_t)(1u << nth_direction(options, words[1] % __builtin_popcount(options)));
+        }
+    }
+}
+
+// Entities of one trophic level learn whether a predator claimed them and, if
+// not, claim their own prey. Predators sit on lower levels, so their claims
+// are final by the time this runs.
+void world_t::decide_feeding(size_t tile, unsigned level)
+{
+    for_each_word(tile, [&](uint32_t i, size_t w, size_t first)
+                  {
+        for (unsigned type : levels_[level])
+        {
+            const uint64_t members = board_row(type, i)[w];
+            if (members == 0)
+                continue;
+            mark_caught(type, i, w, first, members);
+
+            if (species_[type].prey != 0)
+                claim_prey(type, i, w, first, members);
+        } });
+}
+
+// Resolves the meals of the entities that were not eaten and picks the free
+// cells they move and reproduce into
+void world_t::plan_moves(unsigned type, uint32_t i, size_t w, size_t first, uint64_t members, const uint64_t *free)
+{
+    const grid_t &cur = *current_;
+    const species_t &s = species_[type];
+    const unsigned directions = topology_.neighborhood;
+    for (uint64_t bits = members; bits != 0; bits &= bits - 1)
+    {
+        const unsigned k = __builtin_ctzll(bits);
+        const uint32_t j = (uint32_t)(w * 64 + k);
+        const size_t idx = first + k;
+
+        uint8_t won = 0;
+        uint8_t move = NO_DIRECTION;
+        uint8_t spawn = NO_DIRECTION;
+        if (!eaten_[idx])
+        {
+            for (uint8_t eat = eat_[idx]; eat != 0; eat &= eat - 1)
+            {
+                const unsigned dir = __builtin_ctz(eat);
+                if (wins_eat(i, j, dir))
+                    won |= 1u << dir;
+            }
+
+            if (s.move_probability > 0)
+            {
+                const std::array<uint32_t, 4> words = draw(idx, ACTION_MOVE);
+                if (counter_rng_t::unit(words[0]) < s.move_probability)
+                    move = free_direction(free, directions, k, words[1]);
+            }
+
+            // Species without energy grow regardless of it
+            const bool able = !s.uses_energy || cur.energy[idx] + s.energy_gain * __builtin_popcount(won) > s.reproduction_threshold;
+            if (able && s.reproduction_probability > 0)
+            {
+                const std::array<uint32_t, 4> words = draw(idx, s.uses_energy ? ACTION_REPRODUCE : ACTION_GROW);
+                if (counter_rng_t::unit(words[0]) < s.reproduction_probability)
+                    spawn = free_direction(free, directions, k, words[1]);
+            }
+        }
+
+        won_[idx] = won;
+        move_[idx] = move;
+        spawn_[idx] = spawn;
+    }
+}
+
+// Surviving entities resolve their meals and claim empty cells to move, grow or reproduce into
+void world_t::decide_movement(size_t tile)
+{
+    const unsigned last = (unsigned)levels_.size() - 1;
+    for_each_word(tile, [&](uint32_t i, size_t w, size_t first)
+                  {
+        uint64_t free[MOORE];
+        free_neighbors(i, w, free);
+
+        for (unsigned type = 1; type <= species_.size(); ++type)
+        {
+            const uint64_t members = board_row(type, i)[w];
+            if (members == 0)
+                continue;
+
+            // The last level eats nothing, so it has no feeding phase of its own
+            if (level_[type] == last)
+                mark_caught(type, i, w, first, members);
+            plan_moves(type, i, w, first, members, free);
+        } });
+}
+
+// Writes the outcome of every entity of the tile into the next grid. Each
+// cell has at most one writer: an entity's own cell, or a target it won.
+void world_t::apply(size_t tile)
+{
+    const grid_t &cur = *current_;
+    grid_t &next = *next_;
+    std::vector<uint32_t> &dirty = dirty_[tile];
+    for_each_occupied(tile, [&](uint32_t i, uint32_t j, size_t idx)
+                      {
+        const entity_type_t type = (entity_type_t)cur.type[idx];
+
+        // Every living entity has aged, so its cell changes
+        dirty.push_back((uint32_t)idx);
+        if (eaten_[idx])
+        {
+            next.clear(idx);
+            return;
+        }
+
+        const species_t &s = species_[type];
+        int32_t energy = cur.energy[idx] + s.energy_gain * __builtin_popcount(won_[idx]);
+
+        size_t home = idx;
+        if (move_[idx] != NO_DIRECTION && wins_claim(i, j, move_[idx], KIND_MOVE))
+        {
+            neighbor(i, j, move_[idx], home);
+            energy -= s.move_cost;
+            next.clear(idx);
+            dirty.push_back((uint32_t)home);
+        }
+
+        size_t child = idx;
+        if (spawn_[idx] != NO_DIRECTION && wins_claim(i, j, spawn_[idx], KIND_SPAWN) &&
+            neighbor(i, j, spawn_[idx], child))
+        {
+            energy -= s.reproduction_cost;
+            next.set(child, type, s.offspring_energy, 0);
+            dirty.push_back((uint32_t)child);
+        }
+
+        next.set(home, type, energy, cur.age[idx]); });
+}
+
+// Brings the stale buffer and the bitboards up to date at the cells written
+// during the tick. Those may lie in a neighboring tile's rows, so the board
+// words are updated atomically, and only where the type of the cell changed.
+void world_t::copy_forward(size_t tile)
+{
+    const grid_t &cur = *current_;
+    std::vector<uint32_t> &dirty = dirty_[tile];
+    for (uint32_t idx : dirty)
+    {
+        const uint8_t before = next_->type[idx];
+        next_->copy_cell(cur, idx);
+        const uint8_t after = cur.type[idx];
+        if (before == after)
+            continue;
+
+        const uint32_t i = idx / cur.width;
+        const uint32_t j = idx % cur.width;
+        const uint64_t bit = 1ull << (j % 64);
+        if (before != empty)
+            __atomic_fetch_and(&board_row(before, i)[j / 64], ~bit, __ATOMIC_RELAXED);
+        if (after != empty)
+            __atomic_fetch_or(&board_row(after, i)[j / 64], bit, __ATOMIC_RELAXED);
+        if (before == empty)
+            __atomic_fetch_or(&board_row(OCCUPIED, i)[j / 64], bit, __ATOMIC_RELAXED);
+        else if (after == empty)
+            __atomic_fetch_and(&board_row(OCCUPIED, i)[j / 64], ~bit, __ATOMIC_RELAXED);
+    }
+
+    // Cells emptied while aging are already clear everywhere, they only need
+    // to be recorded. Keeping them apart means no two tiles copy the same cell.
+    std::vector<uint32_t> &vacated = vacated_[tile];
+    dirty.insert(dirty.end(), vacated.begin(), vacated.end());
+    vacated.clear();
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include "aging.hpp"
+#include "change_log.hpp"
+#include "grid.hpp"
+#include "rng.hpp"
+#include "species.hpp"
+#include "thread_pool.hpp"
+
+#include <array>
+#include <memory>
+
+// Number of grid rows processed as one parallel task
+const uint32_t TILE_ROWS = 16;
+
+// Neighborhood rules of a run
+struct topology_t
+{
+    bool toroidal = false;     // Edges wrap around instead of bounding the grid
+    unsigned neighborhood = 4; // Cells entities move and reproduce into, 4 (von Neumann) or 8 (Moore)
+};
+
+// Simulation state and tile-parallel step engine.
+//
+// A tick runs in phases separated by barriers. Every phase reads the current
+// grid, which is immutable during the tick, and records per-cell intents
+// (eat, move, spawn) that target a neighboring cell. When several entities
+// claim the same cell the one with the highest hashed (tick, cell, action)
+// priority wins, so the outcome does not depend on scan order or on how the
+// tiles are spread across threads. The phases walk per-species bitboards, so
+// the cost of a tick follows the population rather than the area, and answer
+// neighbor queries 64 cells at a time by shifting those boards. Random
+// draws come from a counter-based generator keyed by (seed, tick, cell,
+// action), which makes a whole run reproducible from its seed.
+//
+// The rules come from a species table. Species are grouped by trophic level
+// and each level but the last gets a feeding phase, predators first, so prey
+// know whether they were caught before choosing their own meal. Nothing is
+// specialized at compile time, neither the species rules nor the topology:
+// the per-cell loops read both at run time, and their branches go the same
+// way for a whole species or run and predict well.
+class world_t
+{
+public:
+    world_t();
+
+    // Rules used from the next reset on, the classic species by default. The
+    // food web must be acyclic, see species_table_t::trophic_levels.
+    void set_species(const species_table_t &species);
+    const species_table_t &species() const { return species_; }
+
+    // Edges and neighborhood of the run, bounded von Neumann by default.
+    // Toroidal grids must be at least 3x3 so that the neighbors of a cell are
+    // distinct.
+    void set_topology(const topology_t &topology);
+    const topology_t &topology() const { return topology_; }
+
+    // Clears the world, resizes it to width x height and restarts the random stream
+    void reset(uint32_t width, uint32_t height, uint64_t seed);
+
+    // Places a new entity, only valid before the first step
+    void place(size_t idx, entity_type_t type, int32_t energy);
+
+    // Places the initial entities on distinct random cells drawn from the seeded
+    // stream in one pass over the grid, counts[k] of entity type k + 1. The
+    // total must not exceed the cell count.
+    void populate(const std::vector<uint32_t> &counts);
+
+    // Resumes a saved run instead of populating: takes over its grid, which
+    // must have the size of the last reset and only types of the current
+    // species, and continues from its tick. The random stream only depends
+    // on the seed and the tick, so the run goes on exactly as it would have.
+    void restore(const grid_t &grid, uint64_t tick);
+
+    // Advances the simulation by one tick
+    void step();
+
+    // Threads the tiles are spread over, at most one per core unless
+    // oversubscribe is set, as checks of thread-count independence do
+    void set_threads(unsigned threads, bool oversubscribe = false);
+    unsigned threads() const { return pool_->size(); }
+
+    const grid_t &grid() const { return *current_; }
+
+    // Counts the entities of each type on the current grid, from the bitboards
+    population_t population() const;
+    uint64_t tick() const { return tick_; }
+    uint64_t seed() const { return rng_.seed; }
+
+    // Sorted cells that changed after the given tick, false when that tick is
+    // too old to be answered from the change log
+    bool changed_since(uint64_t tick, std::vector<uint32_t> &cells) const
+    {
+        return changes_.changed_since(tick, tick_, cells);
+    }
+
+    // Cells written during the last tick, unsorted and possibly repeated
+    const std::vector<uint32_t> &last_changes() const { return changes_.latest(); }
+
+private:
+    // Phases of a tick, each one run for every tile
+    void age(size_t tile);
+    void decide_feeding(size_t tile, unsigned level);
+    void decide_movement(size_t tile);
+    void apply(size_t tile);
+    void copy_forward(size_t tile);
+
+    template <typename F>
+    void for_each_occupied(size_t tile, F &&fn) const;
+    template <typename F>
+    void for_each_word(size_t tile, F &&fn) const;
+
+    // Row i of a bitboard: plane 0 holds every occupied cell, plane t the
+    // cells holding entity type t
+    uint64_t *board_row(unsigned plane, uint32_t i)
+    {
+        return &boards_[((size_t)plane * current_->height + i) * row_words_];
+    }
+    const uint64_t *board_row(unsigned plane, uint32_t i) const
+    {
+        return &boards_[((size_t)plane * current_->height + i) * row_words_];
+    }
+    uint64_t adjacent(unsigned plane, uint32_t i, size_t w, unsigned dir) const;
+    uint64_t adjacent_to(uint32_t types, uint32_t i, size_t w, unsigned directions, uint64_t *masks) const;
+    uint64_t free_neighbors(uint32_t i, size_t w, uint64_t *masks) const;
+
+    // Per-species work on one bitboard word, members being the species' bits
+    void mark_caught(unsigned type, uint32_t i, size_t w, size_t first, uint64_t members);
+    void claim_prey(unsigned type, uint32_t i, size_t w, size_t first, uint64_t members);
+    void plan_moves(unsigned type, uint32_t i, size_t w, size_t first, uint64_t members, const uint64_t *free);
+
+    bool neighbor(uint32_t i, uint32_t j, unsigned dir, size_t &out) const;
+    uint64_t priority(size_t idx, unsigned kind) const;
+    bool wins_eat(uint32_t i, uint32_t j, unsigned dir) const;
+    bool wins_claim(uint32_t i, uint32_t j, unsigned dir, unsigned kind) const;
+    std::array<uint32_t, 4> draw(size_t idx, uint32_t action) const;
+    size_t tile_count() const { return (current_->height + TILE_ROWS - 1) / TILE_ROWS; }
+
+    grid_t buffers_[2];
+    grid_t *current_ = &buffers_[0];
+    grid_t *next_ = &buffers_[1];
+    uint64_t tick_ = 0;
+    counter_rng_t rng_;
+
+    // Per-cell intents produced during a tick
+    std::vector<uint8_t> eat_;    // Bitmask of neighbor directions to eat
+    std::vector<uint8_t> won_;    // Subset of eat_ that won its claim
+    std::vector<uint8_t> move_;   // Direction to move to, or NO_DIRECTION
+    std::vector<uint8_t> spawn_;  // Direction to grow or reproduce into, or NO_DIRECTION
+    std::vector<uint8_t> eaten_;  // Set when the entity is eaten this tick
+
+    // Cells written by each tile during the last tick. The lists keep their
+    // capacity across ticks, so a steady-state tick does not allocate.
+    std::vector<std::vector<uint32_t>> dirty_;
+    std::vector<std::vector<uint32_t>> vacated_; // Cells emptied by the aging phase
+    change_log_t changes_;
+
+    // Bitboards of the current grid, one plane per entity type with plane 0
+    // for any entity, rows padded to whole 64-bit words with zero bits
+    std::vector<uint64_t> boards_;
+    size_t row_words_ = 0;
+
+    species_table_t species_;
+    std::vector<unsigned> level_;                // Trophic level of each type
+    std::vector<std::vector<unsigned>> levels_;  // Types of each trophic level
+    uint32_t threats_[MAXIMUM_SPECIES + 1];      // Bit p set when type p eats the type
+    unsigned threat_range_[MAXIMUM_SPECIES + 1]; // Widest reach among those predators
+
+    aging_kernel_t aging_;
+    aging_rules_t aging_rules_;
+
+    topology_t topology_;
+
+    std::unique_ptr<thread_pool_t> pool_;
+};